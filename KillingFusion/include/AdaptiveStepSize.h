@@ -0,0 +1,33 @@
+#ifndef INC_3DSCANNINGANDMOTIONCAPTURE_ADAPTIVESTEPSIZE_H
+#define INC_3DSCANNINGANDMOTIONCAPTURE_ADAPTIVESTEPSIZE_H
+
+#include <vector>
+#include <Eigen/Eigen>
+
+/**
+ * Per voxel step sizes of gradient descent, following Adam. Running means of the energy gradient and of its square are
+ * kept per voxel in float, next to the displacement field. A voxel with a steady gradient moves by about adaptiveAlpha
+ * per iteration, whatever the scale of its gradient. A voxel whose gradient flips sign or is noisy is slowed down.
+ * Used when UseAdaptiveStepSize is true.
+ */
+class AdaptiveStepSize
+{
+  std::vector<Eigen::Vector3f> m_firstMoment;  // Running mean of gradient.
+  std::vector<Eigen::Vector3f> m_secondMoment; // Running mean of squared gradient, per component.
+  std::vector<int> m_numSteps;                 // Voxels outside the band or frozen take fewer steps.
+
+public:
+  AdaptiveStepSize(int totalNumberOfVoxels);
+
+  /**
+   * Records gradient of voxelIndex and returns its displacement update. Voxels may be updated in parallel, as long as
+   * each voxel is updated by one thread at a time.
+   * The update is normalised, thus does not shrink as the voxel converges. convergenceNorm gets alpha times the norm of
+   * the running mean gradient instead - the step of plain gradient descent - for the stopping and active set rules.
+   */
+  Eigen::Vector3d computeUpdate(int voxelIndex, const Eigen::Vector3d &gradient, double &convergenceNorm);
+
+  static void testComputeUpdate();
+};
+
+#endif //INC_3DSCANNINGANDMOTIONCAPTURE_ADAPTIVESTEPSIZE_H
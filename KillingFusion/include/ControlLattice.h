@@ -0,0 +1,93 @@
+#ifndef INC_3DSCANNINGANDMOTIONCAPTURE_CONTROLLATTICE_H
+#define INC_3DSCANNINGANDMOTIONCAPTURE_CONTROLLATTICE_H
+
+#include <vector>
+#include <Eigen/Eigen>
+#include "DisplacementField.h"
+
+/**
+ * Coarse deformation model - one displacement per control point, placed on every spacing-th voxel node. Displacement
+ * of a voxel is the trilinear interpolation of the 8 control points around it, so that the optimizer solves for
+ * spacing^3 times fewer unknowns. The dense DisplacementField is kept in step with the lattice, thus SDF::update and
+ * fuse keep working on it. Used when UseControlLattice is true.
+ * Voxels are grouped in blocks of spacing^3, whose voxels lie between the same 8 control points. Per-voxel passes
+ * only visit the blocks flagged in isBlockActive, i.e. those near the narrow band.
+ */
+class ControlLattice
+{
+  Eigen::Vector3i m_gridSize;    // Voxel grid the lattice deforms.
+  Eigen::Vector3i m_latticeSize; // Control points per axis, the last ones cover the end of the voxel grid.
+  Eigen::Vector3i m_numBlocksPerAxis;
+  int m_spacing;
+  std::vector<Eigen::Vector3d> m_controlDisplacement;
+
+  int getControlIndex(int cx, int cy, int cz) const
+  {
+    return (cz * m_latticeSize(1) + cy) * m_latticeSize(0) + cx;
+  }
+
+public:
+  ControlLattice(const Eigen::Vector3i &gridSize, int spacing);
+
+  int getNumControlPoints() const
+  {
+    return m_latticeSize.prod();
+  }
+
+  int getNumBlocks() const
+  {
+    return m_numBlocksPerAxis.prod();
+  }
+
+  int getBlockIndex(int x, int y, int z) const
+  {
+    return ((z / m_spacing) * m_numBlocksPerAxis(1) + y / m_spacing) * m_numBlocksPerAxis(0) + x / m_spacing;
+  }
+
+  /**
+   * Voxels [begin, end) of a block.
+   */
+  void getBlockBounds(int block, Eigen::Vector3i &begin, Eigen::Vector3i &end) const;
+
+  /**
+   * Flags the blocks whose voxels are carried by a flagged control point.
+   */
+  std::vector<unsigned char> getCarriedBlocks(const std::vector<unsigned char> &isControlPointFlagged) const;
+
+  /**
+   * Flags the blocks within one block of a flagged block. Voxels carried by a control point all lie in the 8 blocks
+   * around it, so a control point next to a flagged block only moves voxels of the dilated blocks.
+   */
+  std::vector<unsigned char> dilateBlocks(const std::vector<unsigned char> &isBlockFlagged) const;
+
+  /**
+   * Adds controlUpdate to the displacement of each control point, and its trilinear upsampling to the voxels of the
+   * active blocks of field. field stays the lattice on top of its initial value, as long as every updated control
+   * point only carries voxels of active blocks.
+   */
+  void update(const std::vector<Eigen::Vector3d> &controlUpdate,
+              const std::vector<unsigned char> &isBlockActive,
+              DisplacementField *field);
+
+  /**
+   * Gradient of an energy with respect to the control points, from its gradient with respect to each voxel
+   * displacement. This is the transpose of upsampling - each voxel gradient goes to the 8 control points around it,
+   * by the same trilinear weights. controlWeight gets the sum of weights of voxels with non-zero gradient. Only voxels
+   * of active blocks are read.
+   */
+  void accumulateGradient(const std::vector<Eigen::Vector3d> &voxelGradient,
+                          const std::vector<unsigned char> &isBlockActive,
+                          std::vector<Eigen::Vector3d> &controlGradient,
+                          std::vector<double> &controlWeight) const;
+
+  /**
+   * Killing energy gradient of the lattice at a control point, in voxel units as
+   * DisplacementField::computeKillingEnergyGradient2. Differences are taken between control points, so the
+   * regulariser costs one stencil per control point instead of one per voxel.
+   */
+  Eigen::Vector3d computeKillingEnergyGradient(int controlIndex) const;
+
+  static void testUpsample();
+};
+
+#endif //INC_3DSCANNINGANDMOTIONCAPTURE_CONTROLLATTICE_H
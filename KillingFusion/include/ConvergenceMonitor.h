@@ -0,0 +1,78 @@
+#ifndef INC_3DSCANNINGANDMOTIONCAPTURE_CONVERGENCEMONITOR_H
+#define INC_3DSCANNINGANDMOTIONCAPTURE_CONVERGENCEMONITOR_H
+
+#include <string>
+#include <vector>
+#include "DisplacementField.h"
+#include "SDF.h"
+#include "Timer.h"
+
+/**
+ * Summary of one optimizer iteration. Energies are totals over the narrow band, updates are over updated voxels.
+ */
+struct IterationStatistics
+{
+  int iteration = 0;
+  double dataEnergy = 0;
+  double levelSetEnergy = 0;
+  double killingEnergy = 0;
+  double maxUpdate = 0;
+  double rmsUpdate = 0;
+  double quantileUpdate = 0; // updateQuantile of voxel update norms.
+  int numActiveVoxels = 0;
+
+  double getTotalEnergy() const
+  {
+    return dataEnergy + levelSetEnergy + killingEnergy;
+  }
+};
+
+/**
+ * Keeps track of the iterations of one registration and decides when to stop. Registration stops when the first of
+ * the rules enabled in config.cpp is met - max update, update quantile, relative energy decrease or wall-clock budget.
+ */
+class ConvergenceMonitor
+{
+  std::string m_name;
+  bool m_energyTypeUsed[3]; // Data, LevelSet, Killing - Terms optimized by the owner.
+  Timer m_timer;
+  std::vector<IterationStatistics> m_history;
+  bool m_stopWhenEnergyRises;
+
+public:
+  /**
+   * stopWhenEnergyRises - Also stop as soon as total energy goes up. For optimizers whose update norm does not shrink
+   * near the minimum, such as AdaptiveStepSize.
+   */
+  ConvergenceMonitor(const std::string &name, const bool energyTypeUsed[3], bool stopWhenEnergyRises = false);
+
+  /**
+   * Energy is evaluated only if a stopping rule needs it or PrintEnergyEachIteration is set.
+   */
+  bool isEnergyRequired() const;
+
+  /**
+   * Fills Data, LevelSet and Killing energy of src deformed by srcToDest, weighted as in the optimizer.
+   */
+  void computeEnergy(const SDF *src,
+                     const SDF *dest,
+                     const DisplacementField *srcToDest,
+                     IterationStatistics &stats) const;
+
+  /**
+   * Fills max, RMS and quantile update from the update norms of all updated voxels. Reorders updateNorms.
+   */
+  static void computeUpdateStatistics(std::vector<double> &updateNorms, IterationStatistics &stats);
+
+  /**
+   * Records stats of an iteration and returns true when registration should stop.
+   */
+  bool hasConverged(const IterationStatistics &stats);
+
+  const std::vector<IterationStatistics> &getHistory() const
+  {
+    return m_history;
+  }
+};
+
+#endif //INC_3DSCANNINGANDMOTIONCAPTURE_CONVERGENCEMONITOR_H
@@ -0,0 +1,180 @@
+#ifndef INC_3DSCANNINGANDMOTIONCAPTURE_DEFORMEDSDFKERNELS_H
+#define INC_3DSCANNINGANDMOTIONCAPTURE_DEFORMEDSDFKERNELS_H
+
+#include <algorithm>
+#include <vector>
+#include <Eigen/Eigen>
+#include "DisplacementField.h"
+#include "FiniteDifferences.h"
+#include "SDF.h"
+#include "TrilinearSampler.h"
+#include "config.h"
+
+/**
+ * Copy of src SDF, dest SDF and the displacement field in Scalar precision, for the per-voxel kernels of gradient
+ * descent. Stencils are sampled in batches by TrilinearSampler, as in SDF and DisplacementField, and differentiated by
+ * FiniteDifferences<Scalar>, so that with float twice as many values fit in a SIMD register and in cache.
+ * The displacement copy only mirrors the double field, which keeps accumulating the updates.
+ */
+template <typename Scalar>
+class DeformedSdfKernels
+{
+public:
+  typedef Eigen::Matrix<Scalar, 3, 1> Vector3;
+  typedef Eigen::Matrix<Scalar, 3, 3> Matrix3;
+
+private:
+  Eigen::Vector3i m_gridSize;
+  Eigen::Vector3i m_gridSpacingPerAxis;
+  int m_totalNumberOfVoxels;
+  std::vector<Scalar> m_srcDistance;
+  std::vector<Scalar> m_destDistance;
+  std::vector<Vector3> m_displacement;
+
+  // SDF::getDistancesf - src distance at each location moved by the interpolated displacement, in batches.
+  void getDeformedDistances(const Vector3 *gridLocations, int count, Scalar *distances) const
+  {
+    Vector3 displacements[TrilinearSampler::MaxBatchSize];
+    Scalar x[TrilinearSampler::MaxBatchSize], y[TrilinearSampler::MaxBatchSize], z[TrilinearSampler::MaxBatchSize];
+    for (int begin = 0; begin < count; begin += TrilinearSampler::MaxBatchSize)
+    {
+      int batchSize = std::min(count - begin, TrilinearSampler::MaxBatchSize);
+      getDisplacementsAtf(gridLocations + begin, batchSize, displacements);
+      // The 0.5 added by SDF::getDistancef and substracted by SDF::getDistance cancel.
+      for (int i = 0; i < batchSize; i++)
+      {
+        x[i] = gridLocations[begin + i](0) + displacements[i](0);
+        y[i] = gridLocations[begin + i](1) + displacements[i](1);
+        z[i] = gridLocations[begin + i](2) + displacements[i](2);
+      }
+      TrilinearSampler::sampleScalarGrid(m_srcDistance.data(), m_gridSize, Scalar(MaxSurfaceVoxelDistance + epsilon),
+                                         x, y, z, batchSize, distances + begin);
+    }
+  }
+
+  // DisplacementField::getDisplacementsAtf
+  void getDisplacementsAtf(const Vector3 *gridLocations, int count, Vector3 *displacements) const
+  {
+    Scalar x[TrilinearSampler::MaxBatchSize], y[TrilinearSampler::MaxBatchSize], z[TrilinearSampler::MaxBatchSize];
+    for (int begin = 0; begin < count; begin += TrilinearSampler::MaxBatchSize)
+    {
+      int batchSize = std::min(count - begin, TrilinearSampler::MaxBatchSize);
+      for (int i = 0; i < batchSize; i++)
+      {
+        x[i] = gridLocations[begin + i](0);
+        y[i] = gridLocations[begin + i](1);
+        z[i] = gridLocations[begin + i](2);
+      }
+      TrilinearSampler::sampleVectorGrid(m_displacement.data(), m_gridSize, x, y, z, batchSize, displacements + begin);
+    }
+  }
+
+public:
+  DeformedSdfKernels(const SDF *src, const SDF *dest, const DisplacementField *srcToDest)
+      : m_gridSize(src->getGridSize())
+  {
+    m_gridSpacingPerAxis = Eigen::Vector3i(1, m_gridSize(0), m_gridSize(0) * m_gridSize(1));
+    m_totalNumberOfVoxels = m_gridSize.prod();
+    m_srcDistance.resize(m_totalNumberOfVoxels);
+    m_destDistance.resize(m_totalNumberOfVoxels);
+    m_displacement.resize(m_totalNumberOfVoxels);
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int z = 0; z < m_gridSize(2); z++)
+    {
+      for (int y = 0; y < m_gridSize(1); y++)
+      {
+        for (int x = 0; x < m_gridSize(0); x++)
+        {
+          int index = z * m_gridSpacingPerAxis(2) + y * m_gridSpacingPerAxis(1) + x;
+          m_srcDistance[index] = Scalar(src->getDistanceAtIndex(x, y, z));
+          m_destDistance[index] = Scalar(dest->getDistanceAtIndex(x, y, z));
+          m_displacement[index] = srcToDest->getDisplacementAt(x, y, z).template cast<Scalar>();
+        }
+      }
+    }
+  }
+
+  /**
+   * Copies displacement of a voxel, after it was updated in the double field.
+   */
+  void setDisplacement(int voxelIndex, const Eigen::Vector3d &displacement)
+  {
+    m_displacement[voxelIndex] = displacement.template cast<Scalar>();
+  }
+
+  void copyDisplacementField(const DisplacementField &srcToDest)
+  {
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int z = 0; z < m_gridSize(2); z++)
+      for (int y = 0; y < m_gridSize(1); y++)
+        for (int x = 0; x < m_gridSize(0); x++)
+          setDisplacement(z * m_gridSpacingPerAxis(2) + y * m_gridSpacingPerAxis(1) + x, srcToDest.getDisplacementAt(x, y, z));
+  }
+
+  /**
+   * SDF::getDistance(spatialIndex, srcToDest)
+   */
+  Scalar getDeformedDistance(const Eigen::Vector3i &spatialIndex) const
+  {
+    int index = spatialIndex.dot(m_gridSpacingPerAxis);
+    Vector3 gridLocation = spatialIndex.template cast<Scalar>() + m_displacement[index];
+    Scalar distance;
+    TrilinearSampler::sampleScalarGrid(m_srcDistance.data(), m_gridSize, Scalar(MaxSurfaceVoxelDistance + epsilon),
+                                       &gridLocation(0), &gridLocation(1), &gridLocation(2), 1, &distance);
+    return distance;
+  }
+
+  /**
+   * KillingFusion::computeEnergyGradient for the energy terms of Policy. srcSdfDistance is getDeformedDistance.
+   */
+  template <typename Policy>
+  Vector3 computeEnergyGradient(const Eigen::Vector3i &spatialIndex, Scalar srcSdfDistance) const
+  {
+    typedef FiniteDifferences<Scalar> Stencil;
+    Vector3 gradient = Vector3::Zero();
+    Scalar h = Scalar(deltaSize);
+    if (Policy::UseDataEnergy || Policy::UseLevelSetEnergy)
+    {
+      // SDF::computeDistanceGradientAndHessian, hessian samples only for the level set energy.
+      Vector3 gridLocation = spatialIndex.template cast<Scalar>() + Vector3::Constant(Scalar(0.5));
+      const int numSamples = Stencil::NumGradientSamples + (Policy::UseLevelSetEnergy ? Stencil::NumHessianSamples : 0);
+      Vector3 sampleLocations[Stencil::NumGradientSamples + Stencil::NumHessianSamples];
+      Scalar samples[Stencil::NumGradientSamples + Stencil::NumHessianSamples];
+      for (int i = 0; i < Stencil::NumGradientSamples; i++)
+        sampleLocations[i] = gridLocation + h * Stencil::gradientOffset(i);
+      if (Policy::UseLevelSetEnergy)
+        for (int i = 0; i < Stencil::NumHessianSamples; i++)
+          sampleLocations[Stencil::NumGradientSamples + i] = gridLocation + h * Stencil::hessianOffset(i);
+      getDeformedDistances(sampleLocations, numSamples, samples);
+
+      Vector3 distanceGradient = Stencil::gradientFromSamples(samples);
+      if (Policy::UseDataEnergy)
+      {
+        Scalar destDistance = m_destDistance[spatialIndex.dot(m_gridSpacingPerAxis)];
+        gradient += (srcSdfDistance - destDistance) / Scalar(VoxelSize) * distanceGradient;
+      }
+      if (Policy::UseLevelSetEnergy)
+        gradient += Stencil::levelSetEnergyGradient(distanceGradient,
+                                                    Stencil::hessianFromSamples(samples + Stencil::NumGradientSamples)) *
+                    Scalar(omegaLevelSet);
+    }
+    if (Policy::UseKillingEnergy)
+    {
+      // DisplacementField::computeKillingEnergyGradient2
+      Vector3 gridLocation = spatialIndex.template cast<Scalar>();
+      Vector3 sampleLocations[Stencil::NumHessianSamples];
+      Vector3 samples[Stencil::NumHessianSamples];
+      for (int i = 0; i < Stencil::NumHessianSamples; i++)
+        sampleLocations[i] = gridLocation + h * Stencil::hessianOffset(i);
+      getDisplacementsAtf(sampleLocations, Stencil::NumHessianSamples, samples);
+      gradient += Scalar(omegaKilling) * Stencil::killingEnergyGradientFromSamples(samples);
+    }
+    return gradient;
+  }
+};
+
+#endif //INC_3DSCANNINGANDMOTIONCAPTURE_DEFORMEDSDFKERNELS_H
@@ -29,15 +29,48 @@ public:
 
   Eigen::Vector3d getDisplacementAtf(double x, double y, double z) const;
 
+  /**
+   * getDisplacementAtf at count grid locations, sampled in batches by TrilinearSampler.
+   */
+  void getDisplacementsAtf(const Eigen::Vector3d *gridLocations, int count, Eigen::Vector3d *displacements) const;
+
   /**
    * Update(adds) the displacement value at location spatialIndex by deltaUpdate.
    */
   void update(const Eigen::Vector3i &spatialIndex, const Eigen::Vector3d &deltaUpdate);
 
-  DisplacementField &operator+(const DisplacementField &otherDisplacementField);
+  /**
+   * Voxel-wise sum of two fields of the same grid size.
+   */
+  DisplacementField operator+(const DisplacementField &otherDisplacementField) const;
+
+  DisplacementField &operator+=(const DisplacementField &otherDisplacementField);
 
   void initializeAllVoxels(Eigen::Vector3d displacement);
 
+  /**
+   * Sets each voxel to sum of weights[i] * fields[i] at that voxel. All fields must have the same grid size.
+   */
+  void assignLinearCombination(const std::vector<const DisplacementField *> &fields,
+                               const std::vector<double> &weights);
+
+  /**
+   * Composes nextDisplacementField after this field, in place. Voxel p moved to p + this(p) is moved further by
+   * nextDisplacementField interpolated at p + this(p). nextDisplacementField must not be this field.
+   */
+  void compose(const DisplacementField &nextDisplacementField);
+
+  static void testCompose();
+
+  /**
+   * Sets inverse such that p + inverse(p) is moved back to p by this field, by the fixed point iteration
+   * inverse(p) = -this(p + inverse(p)) starting from -this(p). Every voxel iterates on its own, thus all are solved in
+   * parallel. Converges where this field is smooth, i.e. its jacobian norm is below 1.
+   */
+  void invert(DisplacementField *inverse) const;
+
+  static void testInvert();
+
   /**
    * Computes Jacobian of Displacement Field(3d Vector Field) with respect to x,y,z.
    **/
@@ -0,0 +1,150 @@
+#ifndef INC_3DSCANNINGANDMOTIONCAPTURE_FINITEDIFFERENCES_H
+#define INC_3DSCANNINGANDMOTIONCAPTURE_FINITEDIFFERENCES_H
+
+#include <Eigen/Eigen>
+#include "config.h"
+
+/**
+ * Central difference stencils of the per-voxel kernels, on samples taken deltaSize apart. The caller samples the
+ * offsets in one batch and passes the values in the same order. Used in double by SDF and DisplacementField, and in
+ * the precision of DeformedSdfKernels.
+ * Dividing by denominator in real distance causes floating precision errors, thus all derivatives are in voxel units.
+ */
+template <typename Scalar>
+class FiniteDifferences
+{
+public:
+  typedef Eigen::Matrix<Scalar, 3, 1> Vector3;
+  typedef Eigen::Matrix<Scalar, 3, 3> Matrix3;
+
+  static const int NumGradientSamples = 6;
+  static const int NumHessianSamples = 19;
+
+  /**
+   * Offset of sample i of the gradient stencil, in units of deltaSize - +x, -x, +y, -y, +z, -z.
+   */
+  static Vector3 gradientOffset(int i)
+  {
+    return Scalar(i % 2 == 0 ? 1 : -1) * Vector3::Unit(i / 2);
+  }
+
+  /**
+   * Offset of sample i of the hessian stencil, in units of deltaSize.
+   */
+  static Vector3 hessianOffset(int i)
+  {
+    static const int offsets[NumHessianSamples][3] = {
+        {0, 0, 0}, {2, 0, 0}, {-2, 0, 0}, {0, 2, 0}, {0, -2, 0}, {0, 0, 2}, {0, 0, -2}, {1, 0, 1}, {-1, 0, 1},
+        {0, 1, 1}, {0, -1, 1}, {1, 1, 0}, {-1, 1, 0}, {-1, 0, -1}, {1, 0, -1}, {0, -1, -1}, {0, 1, -1}, {-1, -1, 0},
+        {1, -1, 0}};
+    return Vector3(Scalar(offsets[i][0]), Scalar(offsets[i][1]), Scalar(offsets[i][2]));
+  }
+
+  static Vector3 gradientFromSamples(const Scalar *samples)
+  {
+    Vector3 gradient;
+    for (int i = 0; i < 3; i++)
+      gradient(i) = samples[2 * i] - samples[2 * i + 1];
+    return gradient / (2 * Scalar(deltaSize));
+  }
+
+  /**
+   * Second differences fxx, fyy, fzz, fxy, fxz, fyz of the hessian stencil samples, without the 4h^2 denominator.
+   * Value is Scalar for the SDF and Vector3 for the displacement field.
+   */
+  template <typename Value>
+  static void secondDifferencesFromSamples(const Value *samples,
+                                           Value &fxx, Value &fyy, Value &fzz,
+                                           Value &fxy, Value &fxz, Value &fyz)
+  {
+    fxx = (samples[1] - 2 * samples[0] + samples[2]);
+    fyy = (samples[3] - 2 * samples[0] + samples[4]);
+    fzz = (samples[5] - 2 * samples[0] + samples[6]);
+    fxz = (samples[7] + samples[13] - samples[14] - samples[8]);
+    fyz = (samples[9] + samples[15] - samples[16] - samples[10]);
+    fxy = (samples[11] + samples[17] - samples[18] - samples[12]);
+  }
+
+  static Matrix3 hessianFromSamples(const Scalar *samples)
+  {
+    Scalar fxx, fyy, fzz, fxy, fxz, fyz;
+    secondDifferencesFromSamples(samples, fxx, fyy, fzz, fxy, fxz, fyz);
+    Matrix3 hessian;
+    hessian(0, 0) = fxx;
+    hessian(1, 1) = fyy;
+    hessian(2, 2) = fzz;
+    hessian(0, 1) = hessian(1, 0) = fxy;
+    hessian(0, 2) = hessian(2, 0) = fxz;
+    hessian(1, 2) = hessian(2, 1) = fyz;
+    return hessian / (4 * Scalar(deltaSize) * Scalar(deltaSize)); // 4h^2, where h is step size.
+  }
+
+  /**
+   * Gradient of the Killing energy from the displacements at the hessian stencil, clamped to a norm of 0.1 before
+   * dividing by 4h^2.
+   */
+  static Vector3 killingEnergyGradientFromSamples(const Vector3 *samples)
+  {
+    Vector3 displacement_xx, displacement_yy, displacement_zz, displacement_xy, displacement_xz, displacement_yz;
+    secondDifferencesFromSamples(samples, displacement_xx, displacement_yy, displacement_zz,
+                                 displacement_xy, displacement_xz, displacement_yz);
+    // ȫĲԣǰ涪ʧſ˱ȫ
+    Vector3 killingEnergyGradient = -2 * (displacement_xx + displacement_yy + displacement_zz) +
+                                    -2 * Scalar(gammaKilling) * Vector3(
+                                        displacement_xx(0) + displacement_xy(1) + displacement_xz(2),
+                                        displacement_xy(0) + displacement_yy(1) + displacement_yz(2),
+                                        displacement_xz(0) + displacement_yz(1) + displacement_zz(2));
+
+    Scalar killingThreshold = Scalar(0.1);
+    if (killingEnergyGradient.norm() > killingThreshold)
+      killingEnergyGradient = killingEnergyGradient.normalized() * killingThreshold;
+    return killingEnergyGradient / (4 * Scalar(deltaSize) * Scalar(deltaSize));
+  }
+
+  /**
+   * Killing operator 2 * (-laplacian(v) - gammaKilling * grad(div(v))) of a vector field on a lattice of unit spacing,
+   * at spatialIndex. getVector(x, y, z) returns v at a lattice node, it must return zero outside the lattice.
+   */
+  template <typename VectorAccessor>
+  static Vector3 applyKillingOperator(const Eigen::Vector3i &spatialIndex, VectorAccessor getVector)
+  {
+    const Eigen::Vector3i axis[3] = {Eigen::Vector3i(1, 0, 0),
+                                     Eigen::Vector3i(0, 1, 0),
+                                     Eigen::Vector3i(0, 0, 1)};
+    auto at = [&](const Eigen::Vector3i &index) -> Vector3 {
+      return getVector(index(0), index(1), index(2));
+    };
+
+    Vector3 center = at(spatialIndex);
+    Vector3 laplacian = -6 * center;
+    Vector3 gradDivergence;
+    for (int i = 0; i < 3; i++)
+    {
+      Vector3 forward = at(spatialIndex + axis[i]);
+      Vector3 backward = at(spatialIndex - axis[i]);
+      laplacian += forward + backward;
+
+      // d/di (dv_j/dj) summed over j. Second derivative for j == i, mixed derivative otherwise.
+      gradDivergence(i) = forward(i) - 2 * center(i) + backward(i);
+      for (int j = 0; j < 3; j++)
+      {
+        if (j == i)
+          continue;
+        gradDivergence(i) += (at(spatialIndex + axis[i] + axis[j])(j) - at(spatialIndex + axis[i] - axis[j])(j) -
+                              at(spatialIndex - axis[i] + axis[j])(j) + at(spatialIndex - axis[i] - axis[j])(j)) / 4;
+      }
+    }
+    return -2 * (laplacian + Scalar(gammaKilling) * gradDivergence);
+  }
+
+  /**
+   * Gradient of the level set energy (|grad| - 1)^2 / 2 of the displaced SDF, without omegaLevelSet.
+   */
+  static Vector3 levelSetEnergyGradient(const Vector3 &distanceGradient, const Matrix3 &distanceHessian)
+  {
+    Scalar gradientNorm = distanceGradient.norm();
+    return distanceHessian * distanceGradient * (gradientNorm - 1) / (gradientNorm + Scalar(epsilon));
+  }
+};
+
+#endif //INC_3DSCANNINGANDMOTIONCAPTURE_FINITEDIFFERENCES_H
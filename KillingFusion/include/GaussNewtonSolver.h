@@ -0,0 +1,57 @@
+#ifndef INC_3DSCANNINGANDMOTIONCAPTURE_GAUSSNEWTONSOLVER_H
+#define INC_3DSCANNINGANDMOTIONCAPTURE_GAUSSNEWTONSOLVER_H
+
+#include <vector>
+#include <Eigen/Eigen>
+#include "DisplacementField.h"
+#include "SDF.h"
+
+/**
+ * Minimizes Data + LevelSet + Killing energy of src towards dest with Gauss-Newton steps.
+ * Data and LevelSet terms are linearized per voxel, giving one 3x3 block per narrow band voxel. Killing energy is
+ * quadratic in the displacement and is applied matrix-free with its 19 point stencil on the voxel lattice.
+ * Each step solves the normal equations with block-Jacobi preconditioned conjugate gradients.
+ */
+class GaussNewtonSolver
+{
+  const SDF *m_src;
+  const SDF *m_dest;
+  DisplacementField *m_srcToDest;
+  Eigen::Vector3i m_gridSize;
+  Eigen::Vector3i m_gridSpacingPerAxis;
+
+  // Unknowns of the current step - One displacement update per narrow band voxel.
+  std::vector<Eigen::Vector3i> m_bandVoxels;
+  std::vector<int> m_bandIndex; // Grid voxel index to unknown index. -1 if voxel is not in narrow band.
+
+  // Linearization at current displacement field.
+  std::vector<Eigen::Vector3d> m_gradient;
+  std::vector<Eigen::Matrix3d> m_blockDiagonal; // J^T J of Data and LevelSet term + levenbergDamping.
+  std::vector<Eigen::Matrix3d> m_preconditioner; // Inverse of diagonal block including Killing term.
+
+  void buildNarrowBand();
+  void linearize();
+
+  /**
+   * Computes Ap for the normal equations matrix A, without forming A.
+   */
+  void applyNormalEquations(const std::vector<Eigen::Vector3d> &p, std::vector<Eigen::Vector3d> &Ap) const;
+
+  /**
+   * Solves A * delta = -gradient. Returns number of CG iterations performed.
+   */
+  int solveConjugateGradient(std::vector<Eigen::Vector3d> &delta) const;
+
+public:
+  GaussNewtonSolver(const SDF *src,
+                    const SDF *dest,
+                    DisplacementField *srcToDest);
+
+  /**
+   * Performs upto GAUSS_NEWTON_MAX_ITERATIONS steps and updates srcToDest in place. Stops earlier when a
+   * ConvergenceMonitor rule is met after a step.
+   */
+  void solve();
+};
+
+#endif //INC_3DSCANNINGANDMOTIONCAPTURE_GAUSSNEWTONSOLVER_H
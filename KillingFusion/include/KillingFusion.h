@@ -5,98 +5,98 @@
 #ifndef INC_3DSCANNINGANDMOTIONCAPTURE_FUSION_H
 #define INC_3DSCANNINGANDMOTIONCAPTURE_FUSION_H
 
-#include "DatasetReader.h"
-#include "DisplacementField.h"
-#include "SDF.h"
+#include "VariationalFusion.h"
 #include <Eigen/Eigen>
-
-class KillingFusion
+#include <vector>
+
+/**
+ * Energy terms and update strategy of gradient descent as compile time constants, so that the per-voxel kernels carry
+ * no config checks. JacobiUpdate mirrors UsePreviousIterationDeformationField, TrustStrategy mirrors UseTrustStrategy,
+ * SinglePrecision mirrors UseSinglePrecision.
+ */
+template <bool DataEnergy, bool LevelSetEnergy, bool KillingEnergy, bool Jacobi = false, bool Trust = false,
+          bool Single = false>
+struct KillingEnergyPolicy
 {
-  // Variables for processing one frame at a time
-  int m_startFrame;
-  int m_endFrame;
-  int m_currFrameIndex;
-  int m_stride;
-  DisplacementField *m_prev2CanDisplacementField;
-  ////////////////
-
-  DatasetReader m_datasetReader;
-
-  SDF *m_canonicalSdf;
+  static const bool UseDataEnergy = DataEnergy;
+  static const bool UseLevelSetEnergy = LevelSetEnergy;
+  static const bool UseKillingEnergy = KillingEnergy;
+  static const bool JacobiUpdate = Jacobi;
+  static const bool TrustStrategy = Trust;
+  static const bool SinglePrecision = Single;
+};
 
+/**
+ * Optimizes Data, LevelSet and Killing energy with gradient descent, or with Gauss-Newton if UseGaussNewton is set.
+ */
+class KillingFusion : public VariationalFusion
+{
   /**
-   * Computes SDF for frame frameIndex. 
+   * Main Killing Methods
    */
-  SDF *computeSDF(int frameIndex);
+  void computeDisplacementField(const SDF *src,
+                                const SDF *dest,
+                                DisplacementField *srcToDest) override;
 
   /**
-   * ToDo: Fix this Single SDF for all frames issue.
-   * Computes Bound of SDF for all the frames. 
+   * Instantiates the per-voxel kernels for the energy terms used, and the update strategy in config.cpp.
    */
-  std::pair<Eigen::Vector3d, Eigen::Vector3d> computeBounds(int w, int h, double minDepth, double maxDepth);
-  DisplacementField *createZeroDisplacementField(const SDF &sdf);
+  template <bool DataEnergy, bool LevelSetEnergy, bool KillingEnergy, bool SinglePrecision = false>
+  void dispatchUpdateStrategy(const SDF *src,
+                              const SDF *dest,
+                              DisplacementField *srcToDest);
 
   /**
-   * Main Killing Methods
+   * Marks the voxels of bricks whose mean data residual between src deformed by srcToDest and dest is above
+   * residualBrickThreshold, plus a halo of RESIDUAL_BRICK_HALO voxels around them. Used when UseResidualBricks is true.
    */
-  void computeDisplacementField(const SDF *src,
-                                const SDF *dest,
-                                DisplacementField *srcToDest);
-  Eigen::Vector3d computeEnergyGradient(const SDF *src,
-                                        const SDF *dest,
-                                        const DisplacementField *srcDisplacementField,
-                                        const Eigen::Vector3i &spatialIndex);
-  Eigen::Vector3d computeDataEnergyGradient(const SDF *src,
-                                            const SDF *dest,
-                                            const DisplacementField *srcDisplacementField,
-                                            const Eigen::Vector3i &spatialIndex);
-  Eigen::Vector3d computeKillingEnergyGradient(const DisplacementField *srcDisplacementField,
-                                               const Eigen::Vector3i &spatialIndex);
-  Eigen::Vector3d computeLevelSetEnergyGradient(const SDF *src,
-                                                const SDF *dest,
-                                                const DisplacementField *srcDisplacementField,
-                                                const Eigen::Vector3i &spatialIndex);
-
-public:
-  KillingFusion() = delete;
-  KillingFusion(DatasetReader datasetReader);
-  ~KillingFusion();
+  std::vector<unsigned char> selectChangedBricks(const SDF *src,
+                                                 const SDF *dest,
+                                                 const DisplacementField *srcToDest) const;
 
   /**
-   * Performs fusion of all frames.
+   * Gradient descent making one update on all voxels per iteration. Used when UpdateAllVoxelsInEachIter is true.
+   * With Policy::SinglePrecision, band check and energy gradient run on a float copy of src, dest and srcToDest.
    */
-  void process();
+  template <typename Policy>
+  void optimizeAllVoxels(const SDF *src,
+                         const SDF *dest,
+                         DisplacementField *srcToDest);
 
   /**
-   * Fuses one frame in the current canonincal model and returns 3 meshes. 
-   * First is of currentFrame SDF.
-   * Second is of deformed current frame SDF.
-   * Third is of new canonincal SDF.
+   * Gradient descent running all iterations on one voxel before the next one.
    */
-  std::vector<SimpleMesh *> processNextFrame();
+  template <typename Policy>
+  void optimizeVoxelByVoxel(const SDF *src,
+                            const SDF *dest,
+                            DisplacementField *srcToDest);
 
   /**
-   * Test KillingFusion on two Sphere SDF
+   * Gradient descent on the control points of a ControlLattice, added on top of the initial srcToDest. Used when
+   * UseControlLattice is true. Data and LevelSet gradients are taken per voxel in the blocks near the narrow band,
+   * Killing gradient per control point.
    */
-  void processTest(int testType);
+  template <typename Policy>
+  void optimizeControlLattice(const SDF *src,
+                              const SDF *dest,
+                              DisplacementField *srcToDest);
 
   /**
-   * Get the frame index on which processNextFrame works on, in its next call.
+   * Sum of the energy gradients of Policy at spatialIndex. srcSdfDistance is src->getDistance(spatialIndex,
+   * srcDisplacementField), known from the narrow band test.
    */
-  int getCurrentFrameIndex()
-  {
-    return m_currFrameIndex;
-  }
-
-  int getEndFrameIndex()
-  {
-    return m_endFrame;
-  }
+  template <typename Policy>
+  Eigen::Vector3d computeEnergyGradient(const SDF *src,
+                                        const SDF *dest,
+                                        const DisplacementField *srcDisplacementField,
+                                        const Eigen::Vector3i &spatialIndex,
+                                        double srcSdfDistance);
+  Eigen::Vector3d computeKillingEnergyGradient(const DisplacementField *srcDisplacementField,
+                                               const Eigen::Vector3i &spatialIndex);
 
-  DisplacementField* getCurrentFrameDisplacementField()
-  {
-    return m_prev2CanDisplacementField;
-  }
+public:
+  KillingFusion() = delete;
+  KillingFusion(DatasetReader datasetReader);
 };
 
 #endif //INC_3DSCANNINGANDMOTIONCAPTURE_FUSION_H
@@ -421,4 +421,27 @@ int Polygonise(MC_Gridcell grid, double isolevel, MC_Triangle *triangles) {
     return ntriang;
 }
 
+/*
+Corners of the grid cell joined by each of the 12 edges, as used by Polygonise.
+*/
+int edgeCorners[12][2] = {{0, 1}, {1, 2}, {2, 3}, {3, 0}, {4, 5}, {5, 6}, {6, 7}, {7, 4}, {0, 4}, {1, 5}, {2, 6}, {3, 7}};
+
+/*
+Same as Polygonise for a cell of given cube index, but loads the cut edge (0-11) of each triangle vertex in
+triangleEdges instead of its position, so that a vertex on an edge shared by neighbouring cells can be computed once.
+Returns the number of triangles.
+*/
+int PolygoniseEdges(int cubeindex, int *triangleEdges) {
+
+    int ntriang = 0;
+    for (int i = 0; triTable[cubeindex][i] != -1; i += 3) {
+        triangleEdges[i] = triTable[cubeindex][i];
+        triangleEdges[i + 1] = triTable[cubeindex][i + 1];
+        triangleEdges[i + 2] = triTable[cubeindex][i + 2];
+        ntriang++;
+    }
+
+    return ntriang;
+}
+
 #endif // MARCHING_CUBES_H
@@ -8,10 +8,20 @@
 #include <Eigen/Eigen>
 #include <opencv2/opencv.hpp>
 #include <iostream>
+#include <unordered_map>
 #include <vector>
 #include "DisplacementField.h"
 #include "SimpleMesh.h"
 
+// Vertices and triangles of a box of grid cells. Each vertex is keyed by the grid edge it cuts.
+struct MeshSlice
+{
+  std::vector<Vertex> vertices;
+  std::vector<long long> vertexEdges;
+  std::vector<Triangle> triangles;
+  std::unordered_map<long long, unsigned int> edgeToVertex;
+};
+
 // ToDo: SDF should take real world coordinates and return the distance. Not the world coordinates in voxel coordinates.
 class SDF
 {
@@ -22,15 +32,46 @@ class SDF
   // ToDo - Change to vector of vector of vector.
   // Makes notation much simpler as well as reduces the computation of indices.
   std::vector<double> m_voxelGridTSDF;
-  std::vector<long> m_voxelGridWeight;
+  std::vector<short> m_voxelGridWeight; // Saturates at MAX_FUSION_WEIGHT.
   double m_voxelSize; // ToDo: Remove this m_voxelSize. Use directly from config.h
   Eigen::Vector3i m_gridSpacingPerAxis;
   Eigen::Vector3d m_bound;
   double m_unknownClipDistance;
+  // Mesh cache of getCachedMesh, per brick of MESH_BRICK_SIZE^3 cells. fuse, update and integrateDepthFrame mark the
+  // bricks they change as dirty.
+  Eigen::Vector3i m_numBricks;
+  std::vector<unsigned char> m_dirtyBricks;
+  std::vector<MeshSlice> m_brickMeshes;
 
   void computeVoxelGridSize();
   void allocateMemoryForSDF();
-  bool ProcessVolumeCell(int x, int y, int z, double iso, SimpleMesh *mesh) const;
+  // Adds triangles of the non-empty cell at (x,y,z), of marching cubes index cubeIndex and corner distances val.
+  void ProcessVolumeCell(int x, int y, int z, int cubeIndex, const double *val, double iso, MeshSlice *slice) const;
+  // Copies distances of grid nodes at plane z of cells [cellBegin, cellEnd) into plane, with one more node on x and y
+  // axis. Nodes outside of grid get the value of getDistanceAtIndex.
+  void loadDistancePlane(int z, const Eigen::Vector3i &cellBegin, const Eigen::Vector3i &cellEnd, double *plane) const;
+  // Calls visitCell(x, y, z, cubeIndex, val) for each cell of [cellBegin, cellEnd) crossed by the surface at iso, in
+  // the narrow band. val are distances at the 8 corners, in the order of the marching cubes index.
+  template <typename CellVisitor>
+  void forEachSurfaceCell(const Eigen::Vector3i &cellBegin, const Eigen::Vector3i &cellEnd, double iso, CellVisitor visitCell) const;
+  // Marching cubes over cells [cellBegin, cellEnd).
+  void extractCells(const Eigen::Vector3i &cellBegin, const Eigen::Vector3i &cellEnd, MeshSlice *slice) const;
+  // Adds slice of cells [cellBegin, cellEnd) to mesh. Vertices on the boundary of the slice are welded with those of
+  // the slices appended before it through sharedVertices.
+  void appendMeshSlice(const MeshSlice &slice,
+                       const Eigen::Vector3i &cellBegin,
+                       const Eigen::Vector3i &cellEnd,
+                       std::unordered_map<long long, unsigned int> &sharedVertices,
+                       SimpleMesh *mesh) const;
+  // Moves vertices of a mesh of this SDF to where the SDF deformed by displacementField has them.
+  void warpMesh(const DisplacementField &displacementField, SimpleMesh *mesh) const;
+  void getBrickCells(int brickIndex, Eigen::Vector3i &cellBegin, Eigen::Vector3i &cellEnd) const;
+  void markDirtyBrick(int x, int y, int z);
+  // Marks the bricks with a voxel of non-zero otherWeight, after fusing an SDF of same size.
+  void markChangedBricks(const std::vector<short> &otherWeight);
+  // Merges distance dist2 of weight w2 into a voxel, by FUSE_BY_MERGE. A voxel at MAX_FUSION_WEIGHT keeps a running
+  // average over its last updates, and is left as is when dist2 agrees with it within saturatedFuseTolerance.
+  void fuseVoxel(int voxelIndex, double dist2, long w2);
 
 public:
   // ToDo: Remove use of truncationDistanceInVoxelSize and add a method getTruncatedDistance.
@@ -108,6 +149,19 @@ public:
   double getDistancef(const Eigen::Vector3d &gridLocation,
                     const DisplacementField *displacementField) const;
 
+  /**
+   * getDistance at count grid locations, sampled in batches by TrilinearSampler.
+   */
+  void getDistances(const Eigen::Vector3d *gridLocations, int count, double *distances) const;
+
+  /**
+   * getDistancef at count grid locations, sampled in batches by TrilinearSampler.
+   */
+  void getDistancesf(const Eigen::Vector3d *gridLocations,
+                     int count,
+                     const DisplacementField *displacementField,
+                     double *distances) const;
+
   /**
    * Get weight value at grid location of SDF. Grid Location unit is voxel size.
    */
@@ -135,15 +189,33 @@ public:
   Eigen::Matrix3d computeDistanceHessian(const Eigen::Vector3i &spatialIndex,
                                          const DisplacementField *displacementField) const;
 
+  /**
+   * computeDistanceGradient and computeDistanceHessian of the displaced SDF, with the warped samples of both stencils
+   * taken in one batch.
+   */
+  void computeDistanceGradientAndHessian(const Eigen::Vector3i &spatialIndex,
+                                         const DisplacementField *displacementField,
+                                         Eigen::Vector3d &gradient,
+                                         Eigen::Matrix3d &hessian) const;
+
   static void testComputeDistanceHessian();
 
+  static void testFuseSaturation();
+
+  static void testGetCachedMesh();
+
+  static void testGetDeformedMesh();
+
+  static void testGetSurfaceNetsMesh();
+
   /**
    * Fuses otherSdf which should be of same size as this.
    */
   void fuse(const SDF *otherSdf);
 
   /**
-   * Fuses otherSdf using its DisplacementField
+   * Fuses otherSdf using its DisplacementField. Each voxel samples otherSdf at its warped location and merges in one
+   * parallel pass, skipping voxels where the sampled weight is zero.
    */
   void fuse(const SDF *otherSdf, const DisplacementField *otherDisplacementField);
 
@@ -161,8 +233,26 @@ public:
    * Returns mesh of SDF using marching cubes algorithm.
    */
   SimpleMesh *getMesh() const;
+
+  /**
+   * Mesh of the SDF deformed by displacementField, as fuse(this, &displacementField) would build it. Vertices of
+   * getMesh are moved by the inverse of the interpolated displacement, instead of resampling the whole volume.
+   */
   SimpleMesh *getMesh(const DisplacementField &displacementField) const;
 
+  /**
+   * Same mesh as getMesh, but only the bricks changed since the last call are extracted again. The others come from
+   * a per-brick cache.
+   */
+  SimpleMesh *getCachedMesh();
+
+  /**
+   * Mesh of SDF by naive surface nets - one vertex per surface cell and two triangles per crossed grid edge. Better
+   * shaped triangles than marching cubes, for previews. Used by VariationalFusion when UseSurfaceNets.
+   */
+  SimpleMesh *getSurfaceNetsMesh() const;
+  SimpleMesh *getSurfaceNetsMesh(const DisplacementField &displacementField) const;
+
   /**
    * Dumps mesh of SDF with deformation field applied using marching cubes algorithm.
    */
@@ -0,0 +1,36 @@
+#ifndef INC_3DSCANNINGANDMOTIONCAPTURE_SOBOLEVFUSION_H
+#define INC_3DSCANNINGANDMOTIONCAPTURE_SOBOLEVFUSION_H
+
+#include <vector>
+#include "VariationalFusion.h"
+
+/**
+ * SobolevFusion - Gradient flow of Data and LevelSet energy, where the energy gradient is replaced by its Sobolev
+ * gradient. The Sobolev gradient is the L2 gradient convolved with the kernel of (Id - sobolevLambda * laplacian)^-1,
+ * which is approximated by a 1D kernel applied separably along x, y and z. The smoothing of the kernel takes
+ * the place of the Killing motion regularizer.
+ */
+class SobolevFusion : public VariationalFusion
+{
+  std::vector<double> m_sobolevKernel;
+
+  void computeSobolevKernel();
+
+  /**
+   * Convolves one component of the gradient field with m_sobolevKernel along axis. Outside of grid is zero.
+   */
+  void convolveAlongAxis(const std::vector<double> &in,
+                         std::vector<double> &out,
+                         const Eigen::Vector3i &gridSize,
+                         int axis) const;
+
+  void computeDisplacementField(const SDF *src,
+                                const SDF *dest,
+                                DisplacementField *srcToDest) override;
+
+public:
+  SobolevFusion() = delete;
+  SobolevFusion(DatasetReader datasetReader);
+};
+
+#endif //INC_3DSCANNINGANDMOTIONCAPTURE_SOBOLEVFUSION_H
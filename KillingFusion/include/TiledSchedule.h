@@ -0,0 +1,49 @@
+#ifndef INC_3DSCANNINGANDMOTIONCAPTURE_TILEDSCHEDULE_H
+#define INC_3DSCANNINGANDMOTIONCAPTURE_TILEDSCHEDULE_H
+
+#include <vector>
+#include <Eigen/Eigen>
+
+/**
+ * Groups voxels of a grid into cubic tiles of TILE_SIZE voxels, so that a thread sweeps one compact block of the grid
+ * at a time and reuses the SDF and displacement neighbourhood it has in cache. The stencils read a halo of one voxel
+ * around the tile directly from the shared grids. Tiles without voxels are not scheduled.
+ */
+class TiledSchedule
+{
+  Eigen::Vector3i m_gridSize;
+  Eigen::Vector3i m_numTilesPerAxis;
+  int m_tileSize;
+  std::vector<int> m_tileVoxels;  // Voxel indices grouped by tile.
+  std::vector<int> m_tileOffsets; // Tile i holds m_tileVoxels[m_tileOffsets[i]] upto m_tileVoxels[m_tileOffsets[i + 1]].
+
+public:
+  TiledSchedule(const Eigen::Vector3i &gridSize, int tileSize);
+
+  /**
+   * Schedules voxelIndices tile by tile. Order of voxelIndices is kept within a tile.
+   */
+  void build(const std::vector<int> &voxelIndices);
+
+  int getNumTiles() const
+  {
+    return int(m_tileOffsets.size()) - 1;
+  }
+
+  int getTileBegin(int tile) const
+  {
+    return m_tileOffsets[tile];
+  }
+
+  int getTileEnd(int tile) const
+  {
+    return m_tileOffsets[tile + 1];
+  }
+
+  int getVoxelIndex(int i) const
+  {
+    return m_tileVoxels[i];
+  }
+};
+
+#endif //INC_3DSCANNINGANDMOTIONCAPTURE_TILEDSCHEDULE_H
@@ -1,3 +1,6 @@
+#ifndef INC_3DSCANNINGANDMOTIONCAPTURE_TIMER_H
+#define INC_3DSCANNINGANDMOTIONCAPTURE_TIMER_H
+
 #include <iostream>
 #include <chrono>
 
@@ -15,4 +18,6 @@ class Timer
     typedef std::chrono::high_resolution_clock clock_;
     typedef std::chrono::duration<double, std::ratio<1>> second_;
     std::chrono::time_point<clock_> beg_;
-};
\ No newline at end of file
+};
+
+#endif //INC_3DSCANNINGANDMOTIONCAPTURE_TIMER_H
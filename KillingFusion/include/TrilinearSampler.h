@@ -0,0 +1,71 @@
+#ifndef INC_3DSCANNINGANDMOTIONCAPTURE_TRILINEARSAMPLER_H
+#define INC_3DSCANNINGANDMOTIONCAPTURE_TRILINEARSAMPLER_H
+
+#include <Eigen/Eigen>
+
+/**
+ * Trilinear interpolation of a batch of points, for the stencils that sample the same grid around one voxel.
+ * Points are evaluated 8 at a time with AVX-512 or 4 at a time with AVX2 gathers and FMA, picked at runtime from the
+ * CPU, and twice as many at a time in float. Remaining points and other CPUs use interpolate3D. Build with
+ * -DDISABLE_SIMD to always use interpolate3D.
+ * Locations are in grid index units, i.e. without the 0.5 offset of cell centered grids.
+ */
+class TrilinearSampler
+{
+public:
+  static const int MaxBatchSize = 32; // Points gathered on the stack per call by SDF and DisplacementField.
+
+  /**
+   * Interpolates a scalar grid at (x[i], y[i], z[i]) for i < count. Corners outside gridSize read outsideValue, as
+   * SDF::getDistanceAtIndex does.
+   */
+  static void sampleScalarGrid(const double *grid,
+                               const Eigen::Vector3i &gridSize,
+                               double outsideValue,
+                               const double *x,
+                               const double *y,
+                               const double *z,
+                               int count,
+                               double *values);
+
+  /**
+   * Interpolates a vector grid at (x[i], y[i], z[i]) for i < count. Corners whose linear index is outside the grid
+   * read zero, as DisplacementField::getDisplacementAt does.
+   */
+  static void sampleVectorGrid(const Eigen::Vector3d *grid,
+                               const Eigen::Vector3i &gridSize,
+                               const double *x,
+                               const double *y,
+                               const double *z,
+                               int count,
+                               Eigen::Vector3d *values);
+
+  /**
+   * Float overloads, for the float kernels of DeformedSdfKernels.
+   */
+  static void sampleScalarGrid(const float *grid,
+                               const Eigen::Vector3i &gridSize,
+                               float outsideValue,
+                               const float *x,
+                               const float *y,
+                               const float *z,
+                               int count,
+                               float *values);
+
+  static void sampleVectorGrid(const Eigen::Vector3f *grid,
+                               const Eigen::Vector3i &gridSize,
+                               const float *x,
+                               const float *y,
+                               const float *z,
+                               int count,
+                               Eigen::Vector3f *values);
+
+  /**
+   * Instruction set picked at runtime - "avx512", "avx2" or "scalar".
+   */
+  static const char *getInstructionSet();
+
+  static void testSampleGrids();
+};
+
+#endif //INC_3DSCANNINGANDMOTIONCAPTURE_TRILINEARSAMPLER_H
@@ -0,0 +1,154 @@
+//
+// Created by Saurabh Khanduja on 22.10.18.
+//
+
+#ifndef INC_3DSCANNINGANDMOTIONCAPTURE_VARIATIONALFUSION_H
+#define INC_3DSCANNINGANDMOTIONCAPTURE_VARIATIONALFUSION_H
+
+#include <deque>
+#include "DatasetReader.h"
+#include "DisplacementField.h"
+#include "SDF.h"
+#include <Eigen/Eigen>
+
+/**
+ * Frame by frame fusion pipeline shared by all variational fusion techniques.
+ * Derived classes only decide how the displacement field of a frame towards the canonical SDF is optimized.
+ */
+class VariationalFusion
+{
+protected:
+  // Variables for processing one frame at a time
+  int m_startFrame;
+  int m_endFrame;
+  int m_currFrameIndex;
+  int m_stride;
+  DisplacementField *m_prev2CanDisplacementField;
+  std::deque<DisplacementField *> m_displacementFieldHistory; // Copies of last registered fields, most recent first.
+  ////////////////
+
+  DatasetReader m_datasetReader;
+
+  SDF *m_canonicalSdf;
+  SDF *m_prevSdf; // Unwarped SDF of previous frame. Used only with UseFrameToFrameRegistration.
+
+  /**
+   * Computes SDF for frame frameIndex.
+   */
+  SDF *computeSDF(int frameIndex);
+
+  /**
+   * ToDo: Fix this Single SDF for all frames issue.
+   * Computes Bound of SDF for all the frames.
+   */
+  std::pair<Eigen::Vector3d, Eigen::Vector3d> computeBounds(int w, int h, double minDepth, double maxDepth);
+  DisplacementField *createZeroDisplacementField(const SDF &sdf);
+
+  /**
+   * Warm start for next frame - Extrapolates m_displacementFieldHistory with constant velocity, scaled by
+   * warmStartDamping. Velocity is the least squares slope over the last WARM_START_HISTORY frames.
+   */
+  DisplacementField *predictDisplacementField() const;
+
+  /**
+   * Keeps a copy of the registered field of current frame for predictDisplacementField.
+   */
+  void pushDisplacementFieldHistory(const DisplacementField &curr2CanDisplacementField);
+
+  /**
+   * Per-frame registration state shared by process and processNextFrame. startRegistration sets the zero field of
+   * first frame, registerFrame returns the field of currSdf towards the canonical SDF - warm started and frame to frame
+   * as configured - and finishFrame keeps what next frame needs, taking ownership of currSdf.
+   * With UseZeroDisplacementFieldForNextFrame, reusePreviousField starts from the previous field instead of zero.
+   */
+  void startRegistration(const SDF &firstSdf);
+  DisplacementField *registerFrame(const SDF *currSdf, bool reusePreviousField);
+  void finishFrame(SDF *currSdf, DisplacementField *curr2CanDisplacementField);
+
+  /**
+   * Canonical SDF seen from current frame - warped by the inverse of curr2CanDisplacementField.
+   */
+  SDF *computeLiveCanonicalSdf(const DisplacementField &curr2CanDisplacementField) const;
+
+  /**
+   * Optimizes srcToDest in place such that src deformed by srcToDest aligns with dest.
+   */
+  virtual void computeDisplacementField(const SDF *src,
+                                        const SDF *dest,
+                                        DisplacementField *srcToDest) = 0;
+
+  /**
+   * Energy gradients shared by all techniques.
+   */
+  Eigen::Vector3d computeDataEnergyGradient(const SDF *src,
+                                            const SDF *dest,
+                                            const DisplacementField *srcDisplacementField,
+                                            const Eigen::Vector3i &spatialIndex);
+  Eigen::Vector3d computeLevelSetEnergyGradient(const SDF *src,
+                                                const SDF *dest,
+                                                const DisplacementField *srcDisplacementField,
+                                                const Eigen::Vector3i &spatialIndex);
+
+  /**
+   * Fused computeDataEnergyGradient and omegaLevelSet weighted computeLevelSetEnergyGradient, for the terms enabled.
+   * Distance gradient and hessian share one batch of warped samples, and srcPointDistance is the
+   * src->getDistance(spatialIndex, srcDisplacementField) the caller already has from its narrow band test.
+   */
+  void computeDataAndLevelSetEnergyGradient(const SDF *src,
+                                            const SDF *dest,
+                                            const DisplacementField *srcDisplacementField,
+                                            const Eigen::Vector3i &spatialIndex,
+                                            double srcPointDistance,
+                                            bool useDataEnergy,
+                                            bool useLevelSetEnergy,
+                                            Eigen::Vector3d &dataGradient,
+                                            Eigen::Vector3d &levelSetGradient);
+
+public:
+  VariationalFusion() = delete;
+  VariationalFusion(DatasetReader datasetReader);
+  virtual ~VariationalFusion();
+
+  /**
+   * Creates the fusion pipeline selected by fusionTechnique in config.cpp.
+   */
+  static VariationalFusion *create(DatasetReader datasetReader);
+
+  /**
+   * Performs fusion of all frames.
+   */
+  void process();
+
+  /**
+   * Fuses one frame in the current canonincal model and returns 3 meshes.
+   * First is of currentFrame SDF.
+   * Second is of deformed current frame SDF.
+   * Third is of new canonincal SDF.
+   */
+  std::vector<SimpleMesh *> processNextFrame();
+
+  /**
+   * Test fusion on two Sphere SDF
+   */
+  void processTest(int testType);
+
+  /**
+   * Get the frame index on which processNextFrame works on, in its next call.
+   */
+  int getCurrentFrameIndex()
+  {
+    return m_currFrameIndex;
+  }
+
+  int getEndFrameIndex()
+  {
+    return m_endFrame;
+  }
+
+  DisplacementField* getCurrentFrameDisplacementField()
+  {
+    return m_prev2CanDisplacementField;
+  }
+};
+
+#endif //INC_3DSCANNINGANDMOTIONCAPTURE_VARIATIONALFUSION_H
@@ -0,0 +1,47 @@
+#ifndef INC_3DSCANNINGANDMOTIONCAPTURE_VOLUMEOPS_H
+#define INC_3DSCANNINGANDMOTIONCAPTURE_VOLUMEOPS_H
+
+#include <Eigen/Eigen>
+
+/**
+ * Whole-volume passes over the arrays of SDF and DisplacementField. Each pass is one branch free loop split over the
+ * OpenMP threads and vectorized with omp simd, so that it runs at memory bandwidth. A DisplacementField is passed as
+ * 3 * numVoxels doubles.
+ */
+class VolumeOps
+{
+public:
+  static void fill(double *values, int count, double value);
+  static void fill(short *values, int count, short value);
+  static void fill(Eigen::Vector3d *values, int count, const Eigen::Vector3d &value);
+
+  /**
+   * y += alpha * x
+   */
+  static void axpy(double alpha, const double *x, double *y, int count);
+
+  /**
+   * out = alpha * x + beta * y. out may be x or y.
+   */
+  static void blend(double alpha, const double *x, double beta, const double *y, double *out, int count);
+
+  /**
+   * SDF::fuse with FUSE_BY_MERGE, for aligned voxels. Voxels with zero otherWeight are left as is, and so are voxels
+   * at maxWeight whose distance is within saturatedTolerance of otherDistance.
+   */
+  static void mergeWeighted(double *distance,
+                            short *weight,
+                            const double *otherDistance,
+                            const short *otherWeight,
+                            int count,
+                            int maxWeight,
+                            double saturatedTolerance);
+
+  static void minMax(const double *values, int count, double &minValue, double &maxValue);
+
+  static void normRange(const Eigen::Vector3d *values, int count, double &minNorm, double &maxNorm);
+
+  static void testVolumeOps();
+};
+
+#endif //INC_3DSCANNINGANDMOTIONCAPTURE_VOLUMEOPS_H
@@ -12,17 +12,22 @@ const extern double VoxelSize;
 const extern double UnknownClipDistance;
 const extern double MaxSurfaceVoxelDistance;
 const extern bool FUSE_BY_MERGE; // Always set to true. False is not required.
+const extern int MAX_FUSION_WEIGHT;            // Voxel weights saturate here, about one per fused frame, thus settled voxels skip fusion after as many frames. At most 32767, as SDF stores them in short.
+const extern double saturatedFuseTolerance;  // Saturated voxels are not updated by distances closer than this.
+const extern int MESH_BRICK_SIZE;             // Cells per axis of a brick of SDF::getCachedMesh.
+const extern bool UseSurfaceNets;             // Meshes of each frame are extracted by surface nets instead of marching cubes.
 // Dataset and Pipeline to Use
 
-// ToDo: later add another layer of VariationalFusion between main and KillingFusion class and further
-// add the Solobev Fusion.
+// Optimization technique used by VariationalFusion to register each frame to the canonical SDF.
 enum FusionTechnique
 {
-  KILLING_FUSION
+  KILLING_FUSION,
+  SOBOLEV_FUSION // Uses only Data and LevelSet energy of EnergyTypeUsed. Sobolev kernel replaces Killing energy.
 };
 
 const extern FusionTechnique fusionTechnique;
 
+
 /**
  * Mira Slavcheva Deformable Dataset Parameters
  * See: campar.in.tum.de/personal/slavcheva/deformable-dataset/index.html
@@ -53,12 +58,67 @@ const extern std::string OUTPUT_DIR;
 // The below params change how optimization is done over each voxel for next frame.
 const extern bool EnergyTypeUsed[3]; // To enable or disable - Data, LevelSet, Killing
 const extern bool UseZeroDisplacementFieldForNextFrame; // Use Zero Displacement Field for next frame. Only useful when using Data Energy.
+// Warm start - If UseZeroDisplacementFieldForNextFrame is false, next frame starts from the fields of the last
+// WARM_START_HISTORY frames extrapolated with constant velocity. 1 reuses previous field, 2 or 3 extrapolate.
+const extern int WARM_START_HISTORY;
+const extern double warmStartDamping; // Scales the extrapolated velocity. 0 reuses previous field.
+const extern bool UseFrameToFrameRegistration; // Register each frame to previous frame and compose with previous frame to canonical field, instead of registering to canonical SDF.
+const extern bool UseLiveCanonicalTarget; // With UseFrameToFrameRegistration, previous frame is the canonical SDF warped into it by the inverse field, which is more complete than its own SDF.
+const extern int FIELD_INVERSION_ITERATIONS; // Fixed point iterations per voxel of DisplacementField::invert.
+const extern double fieldInversionTolerance; // In voxels. Voxel stops iterating when its inverse displacement changes less.
 const extern bool UpdateAllVoxelsInEachIter; // Update is performed on all voxels for each iterations. If false, all iteration updates are performed on one voxel and then on next. Ideadlly, One should make one update on all voxels, and then perform next iter, thus keey this true. But runs very fast if false. :)
-const extern bool UsePreviousIterationDeformationField; // If true, previous iteration displacement field is used for computing LevelSet Energy and KillingEnergy. 
+const extern bool UsePreviousIterationDeformationField; // If true, previous iteration displacement field is used for computing LevelSet Energy and KillingEnergy. If false, field is updated in place by a Gauss-Seidel sweep over 8 colors.
+
+// Per voxel convergence - Voxels whose update and whose neighbours updates stay below activeSetThreshold are frozen,
+// and are thawed once a neighbour moves again. Approximate, as the updates below activeSetThreshold are dropped, thus
+// keep it well below maxUpdateThreshold. Used only when UpdateAllVoxelsInEachIter is true.
+const extern bool UseActiveSet;
+const extern double activeSetThreshold;
+const extern int TILE_SIZE; // Edge of the cubic tiles that gradient descent sweeps one at a time, in voxels.
+// Residual bricks - Only bricks whose mean data residual after warm start is above residualBrickThreshold voxels are
+// optimized, with a halo around them. Used only when UpdateAllVoxelsInEachIter is true.
+const extern bool UseResidualBricks;
+const extern int RESIDUAL_BRICK_SIZE;
+const extern int RESIDUAL_BRICK_HALO; // In voxels.
+const extern double residualBrickThreshold;
+const extern bool UseControlLattice; // Optimize a coarse lattice of control points upsampled trilinearly, instead of each voxel. Killing energy is taken on the lattice, Data and LevelSet still on each band voxel, thus an iteration costs about as much as a dense one without UseActiveSet.
+const extern int CONTROL_LATTICE_SPACING; // Voxels between two control points along an axis.
+const extern bool UseSinglePrecision; // Per-voxel gradient descent kernels in float. Displacement field and reductions stay double. Default set by SINGLE_PRECISION_KERNELS at build time.
+
+// Convergence monitor - Registration stops when the first enabled rule is met. A rule is disabled when it is 0.
+const extern double maxUpdateThreshold; // Stop when max vector update falls below this.
+const extern double updateQuantile; // Stop when this quantile of vector updates falls below maxUpdateThreshold.
+const extern double minRelativeEnergyDecrease; // Stop when total energy changes by less than this fraction.
+const extern double registrationTimeBudget; // Wall-clock seconds per frame.
+const extern bool PrintEnergyEachIteration; // Evaluate total energy each iteration, even if no rule needs it.
+
 const extern bool UseTrustStrategy; // Only used when working only with data energy. Helps in finding which alpha to use for voxel data energy gradient.
+// Adaptive step size - Per voxel Adam steps instead of alpha. Used only when UpdateAllVoxelsInEachIter is true, and
+// takes the place of UseTrustStrategy. Total energy is evaluated each iteration, and registration also stops as soon as
+// it increases.
+const extern bool UseAdaptiveStepSize;
+const extern double adaptiveAlpha; // Step of a voxel with a steady gradient, in voxels. Stopping and active set rules use alpha * |mean gradient| instead.
+const extern double adaptiveBeta1; // Decay of running mean of gradient.
+const extern double adaptiveBeta2; // Decay of running mean of squared gradient.
+const extern double adaptiveEpsilon;
 
 const extern int KILLING_MAX_ITERATIONS;
 
+// Gauss-Newton optimization - Instead of a gradient step, each outer iteration solves the normal equations of the
+// Data, LevelSet and Killing energy over the narrow band with block-Jacobi preconditioned conjugate gradients.
+// Outer iterations stop by the same rules as gradient descent, maxUpdateThreshold upto registrationTimeBudget.
+const extern bool UseGaussNewton;
+const extern int GAUSS_NEWTON_MAX_ITERATIONS;
+const extern int CG_MAX_ITERATIONS;
+const extern double cgTolerance; // CG stops when residual norm falls below cgTolerance * initial residual norm.
+const extern double levenbergDamping; // Added to diagonal of normal equations. Keeps the step small where SDF is flat.
+
+// Sobolev Fusion - Gradient is smoothed with 1D kernel of (Id - sobolevLambda * laplacian)^-1 along each axis.
+const extern int SOBOLEV_KERNEL_SIZE;
+const extern double sobolevLambda;
+
+
+
 const extern double deltaSize; // Step Size in Voxel unit for central difference.
 
 // learning rates for gradient descent
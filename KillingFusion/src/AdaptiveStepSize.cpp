@@ -0,0 +1,45 @@
+#include "AdaptiveStepSize.h"
+#include <cassert>
+#include <cmath>
+#include "config.h"
+
+AdaptiveStepSize::AdaptiveStepSize(int totalNumberOfVoxels)
+    : m_firstMoment(totalNumberOfVoxels, Eigen::Vector3f::Zero()),
+      m_secondMoment(totalNumberOfVoxels, Eigen::Vector3f::Zero()),
+      m_numSteps(totalNumberOfVoxels, 0)
+{
+}
+
+Eigen::Vector3d AdaptiveStepSize::computeUpdate(int voxelIndex, const Eigen::Vector3d &gradient, double &convergenceNorm)
+{
+  Eigen::Vector3f voxelGradient = gradient.cast<float>();
+  Eigen::Vector3f &firstMoment = m_firstMoment[voxelIndex];
+  Eigen::Vector3f &secondMoment = m_secondMoment[voxelIndex];
+  int numSteps = ++m_numSteps[voxelIndex];
+  const float beta1 = adaptiveBeta1, beta2 = adaptiveBeta2;
+  firstMoment = beta1 * firstMoment + (1 - beta1) * voxelGradient;
+  secondMoment = beta2 * secondMoment + (1 - beta2) * voxelGradient.cwiseProduct(voxelGradient);
+
+  // Means start at zero, thus are scaled up in the first steps.
+  Eigen::Vector3d meanGradient = firstMoment.cast<double>() / (1 - pow(adaptiveBeta1, numSteps));
+  Eigen::Vector3d meanSquaredGradient = secondMoment.cast<double>() / (1 - pow(adaptiveBeta2, numSteps));
+  convergenceNorm = alpha * meanGradient.norm();
+  return -adaptiveAlpha * meanGradient.cwiseQuotient((meanSquaredGradient.cwiseSqrt().array() + adaptiveEpsilon).matrix());
+}
+
+void AdaptiveStepSize::testComputeUpdate()
+{
+  // A steady gradient moves a voxel by adaptiveAlpha per component in each step, whatever its scale, while the
+  // convergence norm follows the gradient.
+  AdaptiveStepSize adaptiveStepSize(2);
+  for (int step = 0; step < 20; step++)
+  {
+    double smallNorm, largeNorm;
+    Eigen::Vector3d smallUpdate = adaptiveStepSize.computeUpdate(0, Eigen::Vector3d(1e-4, -1e-4, 1e-4), smallNorm);
+    Eigen::Vector3d largeUpdate = adaptiveStepSize.computeUpdate(1, Eigen::Vector3d(10, -10, 10), largeNorm);
+    assert((smallUpdate - Eigen::Vector3d(-adaptiveAlpha, adaptiveAlpha, -adaptiveAlpha)).norm() < 1e-3 * adaptiveAlpha &&
+           (largeUpdate - smallUpdate).norm() < 1e-3 * adaptiveAlpha && "Whoops, check AdaptiveStepSize::computeUpdate");
+    assert(fabs(smallNorm - alpha * sqrt(3) * 1e-4) < 1e-3 * smallNorm && fabs(largeNorm - alpha * sqrt(3) * 10) < 1e-3 * largeNorm &&
+           "Whoops, check AdaptiveStepSize::computeUpdate convergence norm");
+  }
+}
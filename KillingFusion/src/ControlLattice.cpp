@@ -0,0 +1,218 @@
+#include "ControlLattice.h"
+#include <cassert>
+#include "FiniteDifferences.h"
+#include "config.h"
+using namespace std;
+
+ControlLattice::ControlLattice(const Eigen::Vector3i &gridSize, int spacing)
+    : m_gridSize(gridSize),
+      m_spacing(spacing)
+{
+  for (int i = 0; i < 3; i++)
+  {
+    m_latticeSize(i) = (m_gridSize(i) - 1 + m_spacing - 1) / m_spacing + 1;
+    m_numBlocksPerAxis(i) = (m_gridSize(i) + m_spacing - 1) / m_spacing;
+  }
+  m_controlDisplacement.resize(m_latticeSize.prod(), Eigen::Vector3d::Zero());
+}
+
+void ControlLattice::getBlockBounds(int block, Eigen::Vector3i &begin, Eigen::Vector3i &end) const
+{
+  begin = Eigen::Vector3i(block % m_numBlocksPerAxis(0),
+                          (block / m_numBlocksPerAxis(0)) % m_numBlocksPerAxis(1),
+                          block / (m_numBlocksPerAxis(0) * m_numBlocksPerAxis(1)));
+  begin *= m_spacing;
+  end = (begin.array() + m_spacing).min(m_gridSize.array());
+}
+
+vector<unsigned char> ControlLattice::getCarriedBlocks(const vector<unsigned char> &isControlPointFlagged) const
+{
+  int numBlocks = getNumBlocks();
+  vector<unsigned char> isBlockCarried(numBlocks, 0);
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int block = 0; block < numBlocks; block++)
+  {
+    // Block b lies between control points b and b + 1 along each axis.
+    Eigen::Vector3i b(block % m_numBlocksPerAxis(0),
+                      (block / m_numBlocksPerAxis(0)) % m_numBlocksPerAxis(1),
+                      block / (m_numBlocksPerAxis(0) * m_numBlocksPerAxis(1)));
+    for (int c = 0; c < 8 && !isBlockCarried[block]; c++)
+    {
+      Eigen::Vector3i controlPoint = b + Eigen::Vector3i(c & 1, c >> 1 & 1, c >> 2 & 1);
+      if ((controlPoint.array() < m_latticeSize.array()).all() &&
+          isControlPointFlagged[getControlIndex(controlPoint(0), controlPoint(1), controlPoint(2))])
+        isBlockCarried[block] = 1;
+    }
+  }
+  return isBlockCarried;
+}
+
+vector<unsigned char> ControlLattice::dilateBlocks(const vector<unsigned char> &isBlockFlagged) const
+{
+  int numBlocks = getNumBlocks();
+  vector<unsigned char> isBlockDilated(numBlocks, 0);
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int block = 0; block < numBlocks; block++)
+  {
+    Eigen::Vector3i b(block % m_numBlocksPerAxis(0),
+                      (block / m_numBlocksPerAxis(0)) % m_numBlocksPerAxis(1),
+                      block / (m_numBlocksPerAxis(0) * m_numBlocksPerAxis(1)));
+    for (int dz = -1; dz <= 1 && !isBlockDilated[block]; dz++)
+      for (int dy = -1; dy <= 1 && !isBlockDilated[block]; dy++)
+        for (int dx = -1; dx <= 1 && !isBlockDilated[block]; dx++)
+        {
+          Eigen::Vector3i n = b + Eigen::Vector3i(dx, dy, dz);
+          if ((n.array() < 0).any() || (n.array() >= m_numBlocksPerAxis.array()).any())
+            continue;
+          if (isBlockFlagged[(n(2) * m_numBlocksPerAxis(1) + n(1)) * m_numBlocksPerAxis(0) + n(0)])
+            isBlockDilated[block] = 1;
+        }
+  }
+  return isBlockDilated;
+}
+
+void ControlLattice::update(const vector<Eigen::Vector3d> &controlUpdate,
+                            const vector<unsigned char> &isBlockActive,
+                            DisplacementField *field)
+{
+  int numControlPoints = getNumControlPoints();
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int i = 0; i < numControlPoints; i++)
+    m_controlDisplacement[i] += controlUpdate[i];
+
+  int numBlocks = getNumBlocks();
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int block = 0; block < numBlocks; block++)
+  {
+    if (!isBlockActive[block])
+      continue;
+    Eigen::Vector3i begin, end;
+    getBlockBounds(block, begin, end);
+    for (int z = begin(2); z < end(2); z++)
+    {
+      for (int y = begin(1); y < end(1); y++)
+      {
+        for (int x = begin(0); x < end(0); x++)
+        {
+          // Lattice cell of the voxel node, and its position inside the cell.
+          int cx = x / m_spacing, cy = y / m_spacing, cz = z / m_spacing;
+          double tx = double(x % m_spacing) / m_spacing;
+          double ty = double(y % m_spacing) / m_spacing;
+          double tz = double(z % m_spacing) / m_spacing;
+          Eigen::Vector3d displacement(0, 0, 0);
+          for (int c = 0; c < 8; c++)
+          {
+            int dx = c & 1, dy = c >> 1 & 1, dz = c >> 2 & 1;
+            double weight = (dx ? tx : 1 - tx) * (dy ? ty : 1 - ty) * (dz ? tz : 1 - tz);
+            if (weight > 0)
+              displacement += weight * controlUpdate[getControlIndex(cx + dx, cy + dy, cz + dz)];
+          }
+          field->update(Eigen::Vector3i(x, y, z), displacement);
+        }
+      }
+    }
+  }
+}
+
+void ControlLattice::accumulateGradient(const vector<Eigen::Vector3d> &voxelGradient,
+                                        const vector<unsigned char> &isBlockActive,
+                                        vector<Eigen::Vector3d> &controlGradient,
+                                        vector<double> &controlWeight) const
+{
+  controlGradient.assign(getNumControlPoints(), Eigen::Vector3d::Zero());
+  controlWeight.assign(getNumControlPoints(), 0);
+  // Each control point gathers from the voxels within one lattice cell of it, so that no two threads write the same
+  // control point.
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int cz = 0; cz < m_latticeSize(2); cz++)
+  {
+    for (int cy = 0; cy < m_latticeSize(1); cy++)
+    {
+      for (int cx = 0; cx < m_latticeSize(0); cx++)
+      {
+        const Eigen::Vector3i controlNode(cx * m_spacing, cy * m_spacing, cz * m_spacing);
+        Eigen::Vector3d gradient(0, 0, 0);
+        double weightSum = 0;
+        // Voxels of the 8 blocks around the control point, cx - 1 and cx along x.
+        for (int c = 0; c < 8; c++)
+        {
+          Eigen::Vector3i block(cx - 1 + (c & 1), cy - 1 + (c >> 1 & 1), cz - 1 + (c >> 2 & 1));
+          if ((block.array() < 0).any() || (block.array() >= m_numBlocksPerAxis.array()).any() ||
+              !isBlockActive[(block(2) * m_numBlocksPerAxis(1) + block(1)) * m_numBlocksPerAxis(0) + block(0)])
+            continue;
+          Eigen::Vector3i begin, end;
+          for (int i = 0; i < 3; i++)
+          {
+            begin(i) = max(block(i) * m_spacing, controlNode(i) - m_spacing + 1);
+            end(i) = min(block(i) * m_spacing + m_spacing, m_gridSize(i));
+          }
+          for (int z = begin(2); z < end(2); z++)
+          {
+            for (int y = begin(1); y < end(1); y++)
+            {
+              for (int x = begin(0); x < end(0); x++)
+              {
+                const Eigen::Vector3d &g = voxelGradient[(z * m_gridSize(1) + y) * m_gridSize(0) + x];
+                if (g.isZero(0))
+                  continue;
+                double weight = (1 - abs(x - controlNode(0)) / double(m_spacing)) *
+                                (1 - abs(y - controlNode(1)) / double(m_spacing)) *
+                                (1 - abs(z - controlNode(2)) / double(m_spacing));
+                gradient += weight * g;
+                weightSum += weight;
+              }
+            }
+          }
+        }
+        int controlIndex = getControlIndex(cx, cy, cz);
+        controlGradient[controlIndex] = gradient;
+        controlWeight[controlIndex] = weightSum;
+      }
+    }
+  }
+}
+
+Eigen::Vector3d ControlLattice::computeKillingEnergyGradient(int controlIndex) const
+{
+  Eigen::Vector3i controlPoint(controlIndex % m_latticeSize(0),
+                               (controlIndex / m_latticeSize(0)) % m_latticeSize(1),
+                               controlIndex / (m_latticeSize(0) * m_latticeSize(1)));
+  auto getControlDisplacement = [this](int cx, int cy, int cz) -> Eigen::Vector3d {
+    if (cx < 0 || cy < 0 || cz < 0 || cx >= m_latticeSize(0) || cy >= m_latticeSize(1) || cz >= m_latticeSize(2))
+      return Eigen::Vector3d::Zero();
+    return m_controlDisplacement[getControlIndex(cx, cy, cz)];
+  };
+  // Second differences over spacing voxels.
+  return FiniteDifferences<double>::applyKillingOperator(controlPoint, getControlDisplacement) / (m_spacing * m_spacing);
+}
+
+void ControlLattice::testUpsample()
+{
+  // A linear displacement on the control points is reproduced exactly at every voxel.
+  double voxelSize = 0.5;
+  Eigen::Vector3i gridSize(9, 7, 5);
+  ControlLattice lattice(gridSize, 4);
+  vector<Eigen::Vector3d> controlUpdate(lattice.getNumControlPoints());
+  for (int cz = 0; cz < lattice.m_latticeSize(2); cz++)
+    for (int cy = 0; cy < lattice.m_latticeSize(1); cy++)
+      for (int cx = 0; cx < lattice.m_latticeSize(0); cx++)
+        controlUpdate[lattice.getControlIndex(cx, cy, cz)] = Eigen::Vector3d(cy, cz, cx) * 4;
+  DisplacementField field(gridSize, voxelSize);
+  field.initializeAllVoxels(Eigen::Vector3d(1, 2, 3));
+  lattice.update(controlUpdate, vector<unsigned char>(lattice.getNumBlocks(), 1), &field);
+  for (int z = 0; z < gridSize(2); z++)
+    for (int y = 0; y < gridSize(1); y++)
+      for (int x = 0; x < gridSize(0); x++)
+        assert((field.getDisplacementAt(x, y, z) - Eigen::Vector3d(1 + y, 2 + z, 3 + x)).norm() < epsilon &&
+               "Whoops! Check ControlLattice::update");
+}
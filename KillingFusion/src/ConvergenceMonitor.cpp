@@ -0,0 +1,130 @@
+#include "ConvergenceMonitor.h"
+#include <algorithm>
+#include "config.h"
+using namespace std;
+
+ConvergenceMonitor::ConvergenceMonitor(const string &name, const bool energyTypeUsed[3], bool stopWhenEnergyRises)
+    : m_name(name),
+      m_stopWhenEnergyRises(stopWhenEnergyRises)
+{
+  for (int i = 0; i < 3; i++)
+    m_energyTypeUsed[i] = energyTypeUsed[i];
+}
+
+bool ConvergenceMonitor::isEnergyRequired() const
+{
+  return minRelativeEnergyDecrease > 0 || m_stopWhenEnergyRises || PrintEnergyEachIteration;
+}
+
+void ConvergenceMonitor::computeEnergy(const SDF *src,
+                                       const SDF *dest,
+                                       const DisplacementField *srcToDest,
+                                       IterationStatistics &stats) const
+{
+  Eigen::Vector3i gridSize = src->getGridSize();
+  double dataEnergy = 0, levelSetEnergy = 0, killingEnergy = 0;
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(+ : dataEnergy, levelSetEnergy, killingEnergy)
+#endif
+  for (int z = 0; z < gridSize(2); z++)
+  {
+    for (int y = 0; y < gridSize(1); y++)
+    {
+      for (int x = 0; x < gridSize(0); x++)
+      {
+        // Same narrow band as the optimizer.
+        const Eigen::Vector3i spatialIndex(x, y, z);
+        double srcSdfDistance = src->getDistance(spatialIndex, srcToDest);
+        if (srcSdfDistance > MaxSurfaceVoxelDistance - epsilon || srcSdfDistance < -UnknownClipDistance)
+          continue;
+
+        // Integrals of VariationalFusion::computeDataEnergyGradient and computeLevelSetEnergyGradient.
+        if (m_energyTypeUsed[0])
+        {
+          double residual = srcSdfDistance - dest->getDistanceAtIndex(spatialIndex);
+          dataEnergy += residual * residual / (2 * VoxelSize);
+        }
+        if (m_energyTypeUsed[1])
+        {
+          double gradientNorm = src->computeDistanceGradient(spatialIndex, srcToDest).norm();
+          levelSetEnergy += omegaLevelSet * (gradientNorm - 1) * (gradientNorm - 1) / 2;
+        }
+        if (m_energyTypeUsed[2])
+          killingEnergy += omegaKilling * srcToDest->computeKillingEnergy(x, y, z);
+      }
+    }
+  }
+  stats.dataEnergy = dataEnergy;
+  stats.levelSetEnergy = levelSetEnergy;
+  stats.killingEnergy = killingEnergy;
+}
+
+void ConvergenceMonitor::computeUpdateStatistics(vector<double> &updateNorms, IterationStatistics &stats)
+{
+  int numUpdates = updateNorms.size();
+  double maxUpdate = 0, sumSquaredUpdate = 0;
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(static) reduction(max : maxUpdate) reduction(+ : sumSquaredUpdate)
+#endif
+  for (int i = 0; i < numUpdates; i++)
+  {
+    maxUpdate = max(maxUpdate, updateNorms[i]);
+    sumSquaredUpdate += updateNorms[i] * updateNorms[i];
+  }
+  stats.maxUpdate = maxUpdate;
+  stats.rmsUpdate = numUpdates > 0 ? sqrt(sumSquaredUpdate / numUpdates) : 0;
+
+  stats.quantileUpdate = maxUpdate;
+  if (updateQuantile > 0 && numUpdates > 0)
+  {
+    auto quantile = updateNorms.begin() + min(int(updateQuantile * numUpdates), numUpdates - 1);
+    nth_element(updateNorms.begin(), quantile, updateNorms.end());
+    stats.quantileUpdate = *quantile;
+  }
+}
+
+bool ConvergenceMonitor::hasConverged(const IterationStatistics &stats)
+{
+  m_history.push_back(stats);
+  cout << m_name << " iteration " << stats.iteration << ": max update " << stats.maxUpdate
+       << ", rms update " << stats.rmsUpdate << ", active voxels " << stats.numActiveVoxels;
+  if (isEnergyRequired())
+    cout << ", energy " << stats.getTotalEnergy() << " (data " << stats.dataEnergy << ", levelset "
+         << stats.levelSetEnergy << ", killing " << stats.killingEnergy << ")";
+  cout << endl;
+
+  // Registration is terminated when the magnitude of the maximum vector update falls below 0.1 mm.
+  if (stats.maxUpdate < maxUpdateThreshold)
+  {
+    cout << m_name << " converged at iteration " << stats.iteration << ": max update below threshold" << endl;
+    return true;
+  }
+  if (updateQuantile > 0 && stats.quantileUpdate < maxUpdateThreshold)
+  {
+    cout << m_name << " converged at iteration " << stats.iteration << ": " << updateQuantile
+         << " quantile of update below threshold" << endl;
+    return true;
+  }
+  if (minRelativeEnergyDecrease > 0 && m_history.size() > 1)
+  {
+    double prevEnergy = m_history[m_history.size() - 2].getTotalEnergy();
+    if (fabs(prevEnergy - stats.getTotalEnergy()) < minRelativeEnergyDecrease * fabs(prevEnergy))
+    {
+      cout << m_name << " converged at iteration " << stats.iteration << ": energy stopped decreasing" << endl;
+      return true;
+    }
+  }
+  if (m_stopWhenEnergyRises && m_history.size() > 1 &&
+      stats.getTotalEnergy() > m_history[m_history.size() - 2].getTotalEnergy())
+  {
+    cout << m_name << " converged at iteration " << stats.iteration << ": energy increased" << endl;
+    return true;
+  }
+  if (registrationTimeBudget > 0 && m_timer.elapsed() > registrationTimeBudget)
+  {
+    cout << m_name << " stopped at iteration " << stats.iteration << ": time budget of "
+         << registrationTimeBudget << "s exceeded" << endl;
+    return true;
+  }
+  return false;
+}
@@ -3,6 +3,9 @@
 #include <fstream>
 #include "config.h"
 #include "utils.h"
+#include "FiniteDifferences.h"
+#include "TrilinearSampler.h"
+#include "VolumeOps.h"
 using namespace std;
 
 DisplacementField::DisplacementField(Eigen::Vector3i _gridSize,
@@ -62,6 +65,24 @@ Eigen::Vector3d DisplacementField::getDisplacementAtf(double x, double y, double
     return getDisplacementAtf(Eigen::Vector3d(x, y, z));
 }
 
+void DisplacementField::getDisplacementsAtf(const Eigen::Vector3d *gridLocations,
+                                            int count,
+                                            Eigen::Vector3d *displacements) const
+{
+    double x[TrilinearSampler::MaxBatchSize], y[TrilinearSampler::MaxBatchSize], z[TrilinearSampler::MaxBatchSize];
+    for (int begin = 0; begin < count; begin += TrilinearSampler::MaxBatchSize)
+    {
+        int batchSize = min(count - begin, TrilinearSampler::MaxBatchSize);
+        for (int i = 0; i < batchSize; i++)
+        {
+            x[i] = gridLocations[begin + i](0);
+            y[i] = gridLocations[begin + i](1);
+            z[i] = gridLocations[begin + i](2);
+        }
+        TrilinearSampler::sampleVectorGrid(m_gridDisplacementValue.data(), m_gridSize, x, y, z, batchSize, displacements + begin);
+    }
+}
+
 void DisplacementField::update(const Eigen::Vector3i &spatialIndex,
                                const Eigen::Vector3d &deltaUpdate)
 {
@@ -70,23 +91,143 @@ void DisplacementField::update(const Eigen::Vector3i &spatialIndex,
     m_gridDisplacementValue.at(index) += deltaUpdate;
 }
 
-DisplacementField &DisplacementField::operator+(const DisplacementField &otherDisplacementField)
+DisplacementField DisplacementField::operator+(const DisplacementField &otherDisplacementField) const
 {
-    for (size_t i = 0; i < m_gridSize.prod(); i++)
-    {
-        this->m_gridDisplacementValue[i] += otherDisplacementField.m_gridDisplacementValue[i];
-    }
+    DisplacementField sum(m_gridSize, m_voxelSize);
+    VolumeOps::blend(1, m_gridDisplacementValue.data()->data(),
+                     1, otherDisplacementField.m_gridDisplacementValue.data()->data(),
+                     sum.m_gridDisplacementValue.data()->data(), 3 * m_gridSize.prod());
+    return sum;
+}
+
+DisplacementField &DisplacementField::operator+=(const DisplacementField &otherDisplacementField)
+{
+    VolumeOps::axpy(1, otherDisplacementField.m_gridDisplacementValue.data()->data(),
+                    m_gridDisplacementValue.data()->data(), 3 * m_gridSize.prod());
     return *this;
 }
 
 void DisplacementField::initializeAllVoxels(Eigen::Vector3d displacement)
 {
-    for (size_t i = 0; i < m_gridSize.prod(); i++)
+    VolumeOps::fill(m_gridDisplacementValue.data(), m_gridSize.prod(), displacement);
+}
+
+void DisplacementField::assignLinearCombination(const std::vector<const DisplacementField *> &fields,
+                                                const std::vector<double> &weights)
+{
+    int totalNumberOfVoxels = m_gridSize.prod();
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int i = 0; i < totalNumberOfVoxels; i++)
+    {
+        Eigen::Vector3d displacement = Eigen::Vector3d::Zero();
+        for (size_t j = 0; j < fields.size(); j++)
+            displacement += weights[j] * fields[j]->m_gridDisplacementValue[i];
+        m_gridDisplacementValue[i] = displacement;
+    }
+}
+
+void DisplacementField::compose(const DisplacementField &nextDisplacementField)
+{
+    // Each voxel reads only its own displacement from this field, thus it can be updated in place.
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int z = 0; z < m_gridSize(2); z++)
+    {
+        for (int y = 0; y < m_gridSize(1); y++)
+        {
+            for (int x = 0; x < m_gridSize(0); x++)
+            {
+                int index = z * m_gridSpacingPerAxis(2) + y * m_gridSpacingPerAxis(1) + x;
+                Eigen::Vector3d movedGridLocation = Eigen::Vector3d(x, y, z) + m_gridDisplacementValue[index];
+                m_gridDisplacementValue[index] += nextDisplacementField.getDisplacementAtf(movedGridLocation);
+            }
+        }
+    }
+}
+
+void DisplacementField::testCompose()
+{
+    // Composing with a linear field must give the analytic result, as trilinear interpolation is exact for it.
+    double voxelSize = 0.5;
+    DisplacementField firstField(Eigen::Vector3i(8, 8, 8), voxelSize);
+    DisplacementField nextField(Eigen::Vector3i(8, 8, 8), voxelSize);
+    firstField.initializeAllVoxels(Eigen::Vector3d(1, 0.5, 0.25));
+    for (int x = 0; x < 8; x++)
+    {
+        for (int y = 0; y < 8; y++)
+        {
+            for (int z = 0; z < 8; z++)
+            {
+                // G(x,y,z) = (y, z, x) / 4
+                nextField.update(Eigen::Vector3i(x, y, z), Eigen::Vector3d(y, z, x) / 4);
+            }
+        }
+    }
+
+    firstField.compose(nextField);
+    for (int x = 0; x < 6; x++)
     {
-        this->m_gridDisplacementValue[i] = displacement;
+        for (int y = 0; y < 6; y++)
+        {
+            for (int z = 0; z < 6; z++)
+            {
+                Eigen::Vector3d expected = Eigen::Vector3d(1, 0.5, 0.25) + Eigen::Vector3d(y + 0.5, z + 0.25, x + 1) / 4;
+                assert((firstField.getDisplacementAt(x, y, z) - expected).norm() < epsilon && "Whoops! Check DisplacementField::testCompose");
+            }
+        }
     }
 }
 
+void DisplacementField::invert(DisplacementField *inverse) const
+{
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int z = 0; z < m_gridSize(2); z++)
+    {
+        for (int y = 0; y < m_gridSize(1); y++)
+        {
+            for (int x = 0; x < m_gridSize(0); x++)
+            {
+                int index = z * m_gridSpacingPerAxis(2) + y * m_gridSpacingPerAxis(1) + x;
+                Eigen::Vector3d gridLocation(x, y, z);
+                Eigen::Vector3d inverseDisplacement = -m_gridDisplacementValue[index];
+                for (int i = 0; i < FIELD_INVERSION_ITERATIONS; i++)
+                {
+                    Eigen::Vector3d nextInverseDisplacement = -getDisplacementAtf(gridLocation + inverseDisplacement);
+                    double change = (nextInverseDisplacement - inverseDisplacement).norm();
+                    inverseDisplacement = nextInverseDisplacement;
+                    if (change < fieldInversionTolerance)
+                        break;
+                }
+                inverse->m_gridDisplacementValue[index] = inverseDisplacement;
+            }
+        }
+    }
+}
+
+void DisplacementField::testInvert()
+{
+    // Inverse of a smooth field composed after it gives back the identity, away from the grid boundary.
+    double voxelSize = 0.5;
+    DisplacementField field(Eigen::Vector3i(12, 12, 12), voxelSize);
+    DisplacementField inverse(Eigen::Vector3i(12, 12, 12), voxelSize);
+    for (int x = 0; x < 12; x++)
+        for (int y = 0; y < 12; y++)
+            for (int z = 0; z < 12; z++)
+                field.update(Eigen::Vector3i(x, y, z), Eigen::Vector3d(0.5 + 0.05 * y, 0.25 - 0.05 * z, 0.1 * x / 2));
+    field.invert(&inverse);
+    inverse.compose(field);
+    for (int x = 3; x < 9; x++)
+        for (int y = 3; y < 9; y++)
+            for (int z = 3; z < 9; z++)
+                assert(inverse.getDisplacementAt(x, y, z).norm() < 10 * fieldInversionTolerance &&
+                       "Whoops! Check DisplacementField::invert");
+}
+
 Eigen::Matrix3d DisplacementField::computeJacobian(double x, double y, double z) const
 {
     // Future Tasks:- Add boundary checks.
@@ -304,50 +445,13 @@ Eigen::Vector3d DisplacementField::computeKillingEnergyGradient(const Eigen::Vec
 Eigen::Vector3d DisplacementField::computeKillingEnergyGradient2(const Eigen::Vector3i &spatialIndex) const
 {
     Eigen::Vector3d gridLocation = spatialIndex.cast<double>();
-    // ToDo: Optimize
-    Eigen::Vector3d displacement_xyz = getDisplacementAtf(gridLocation + deltaSize * Eigen::Vector3d(0, 0, 0));
-    Eigen::Vector3d displacement_xplus2yz = getDisplacementAtf(gridLocation + deltaSize * Eigen::Vector3d(2, 0, 0));
-    Eigen::Vector3d displacement_xminus2yz = getDisplacementAtf(gridLocation + deltaSize * Eigen::Vector3d(-2, 0, 0));
-    Eigen::Vector3d displacement_xyplus2z = getDisplacementAtf(gridLocation + deltaSize * Eigen::Vector3d(0, 2, 0));
-    Eigen::Vector3d displacement_xyminus2z = getDisplacementAtf(gridLocation + deltaSize * Eigen::Vector3d(0, -2, 0));
-    Eigen::Vector3d displacement_xyzplus2 = getDisplacementAtf(gridLocation + deltaSize * Eigen::Vector3d(0, 0, 2));
-    Eigen::Vector3d displacement_xyzminus2 = getDisplacementAtf(gridLocation + deltaSize * Eigen::Vector3d(0, 0, -2));
-    Eigen::Vector3d displacement_xplus1yzplus1 = getDisplacementAtf(gridLocation + deltaSize * Eigen::Vector3d(1, 0, 1));
-    Eigen::Vector3d displacement_xminus1yzplus1 = getDisplacementAtf(gridLocation + deltaSize * Eigen::Vector3d(-1, 0, 1));
-    Eigen::Vector3d displacement_xyplus1zplus1 = getDisplacementAtf(gridLocation + deltaSize * Eigen::Vector3d(0, 1, 1));
-    Eigen::Vector3d displacement_xyminus1zplus1 = getDisplacementAtf(gridLocation + deltaSize * Eigen::Vector3d(0, -1, 1));
-    Eigen::Vector3d displacement_xplus1yplus1z = getDisplacementAtf(gridLocation + deltaSize * Eigen::Vector3d(1, 1, 0));
-    Eigen::Vector3d displacement_xminus1yplus1z = getDisplacementAtf(gridLocation + deltaSize * Eigen::Vector3d(-1, 1, 0));
-    Eigen::Vector3d displacement_xminus1yzminus1 = getDisplacementAtf(gridLocation + deltaSize * Eigen::Vector3d(-1, 0, -1));
-    Eigen::Vector3d displacement_xplus1yzminus1 = getDisplacementAtf(gridLocation + deltaSize * Eigen::Vector3d(1, 0, -1));
-    Eigen::Vector3d displacement_xyminus1zminus1 = getDisplacementAtf(gridLocation + deltaSize * Eigen::Vector3d(0, -1, -1));
-    Eigen::Vector3d displacement_xyplus1zminus1 = getDisplacementAtf(gridLocation + deltaSize * Eigen::Vector3d(0, 1, -1));
-    Eigen::Vector3d displacement_xminus1yminus1z = getDisplacementAtf(gridLocation + deltaSize * Eigen::Vector3d(-1, -1, 0));
-    Eigen::Vector3d displacement_xplus1yminus1z = getDisplacementAtf(gridLocation + deltaSize * Eigen::Vector3d(1, -1, 0));
-
-    Eigen::Vector3d displacement_xx, displacement_yy, displacement_zz, displacement_xy, displacement_xz, displacement_yz;
-    displacement_xx = (displacement_xplus2yz - 2 * displacement_xyz + displacement_xminus2yz);
-    displacement_yy = (displacement_xyplus2z - 2 * displacement_xyz + displacement_xyminus2z);
-    displacement_zz = (displacement_xyzplus2 - 2 * displacement_xyz + displacement_xyzminus2);
-    displacement_xz = (displacement_xplus1yzplus1 + displacement_xminus1yzminus1 - displacement_xplus1yzminus1 - displacement_xminus1yzplus1);
-    displacement_yz = (displacement_xyplus1zplus1 + displacement_xyminus1zminus1 - displacement_xyplus1zminus1 - displacement_xyminus1zplus1);
-    displacement_xy = (displacement_xplus1yplus1z + displacement_xminus1yminus1z - displacement_xplus1yminus1z - displacement_xminus1yplus1z);
-
-	// ȫĲԣǰ涪ʧſ˱ȫ
-    Eigen::Vector3d killingEnergyGradient = -2 * (displacement_xx + displacement_yy + displacement_zz) +
-                                            -2 * gammaKilling * Eigen::Vector3d(
-                                                displacement_xx(0) + displacement_xy(1) + displacement_xz(2), 
-                                                displacement_xy(0) + displacement_yy(1) + displacement_yz(2),
-                                                displacement_xz(0) + displacement_yz(1) + displacement_zz(2));
-
-    // Dividing by denominator in real distance causes floating precision errors. Keep unit in voxel size.
-    double denominator = (4 * deltaSize * deltaSize); // 4h^2, where h is step size.
-
-    double killingThreshold = 0.1;
-    if(killingEnergyGradient.norm() > killingThreshold) {
-        killingEnergyGradient = killingEnergyGradient.normalized() * killingThreshold;
-    }
-    return killingEnergyGradient / denominator;
+    // All samples of the stencil in one batch.
+    Eigen::Vector3d sampleLocations[FiniteDifferences<double>::NumHessianSamples];
+    Eigen::Vector3d samples[FiniteDifferences<double>::NumHessianSamples];
+    for (int i = 0; i < FiniteDifferences<double>::NumHessianSamples; i++)
+        sampleLocations[i] = gridLocation + deltaSize * FiniteDifferences<double>::hessianOffset(i);
+    getDisplacementsAtf(sampleLocations, FiniteDifferences<double>::NumHessianSamples, samples);
+    return FiniteDifferences<double>::killingEnergyGradientFromSamples(samples);
 }
 
 void DisplacementField::dumpToBinFile(string outputFilePath) const
@@ -357,13 +461,9 @@ void DisplacementField::dumpToBinFile(string outputFilePath) const
     ofstream outFile(outputFilePath, ios::binary | ios::out);
     outFile.write((char *)m_gridSize.data(), 3 * sizeof(int));
     outFile.write((char *)&m_voxelSize, sizeof(double));
-    double minDisp = 1000, maxDisp = -1000; 
-    for (size_t i = 0; i < m_gridSize.prod(); i++)
-    {
-        outFile.write((char *)(m_gridDisplacementValue[i].data()), 3 * sizeof(double));
-        minDisp = std::min(minDisp, m_gridDisplacementValue[i].norm());
-        maxDisp = std::max(maxDisp, m_gridDisplacementValue[i].norm());
-    }
+    outFile.write((char *)(m_gridDisplacementValue.data()->data()), 3 * m_gridSize.prod() * sizeof(double));
+    double minDisp, maxDisp;
+    VolumeOps::normRange(m_gridDisplacementValue.data(), m_gridSize.prod(), minDisp, maxDisp);
     cout << "minDisp is " << minDisp << " and maxDisp is " << maxDisp << endl;
     outFile.close();
     cout << "============================================================================\n";
@@ -0,0 +1,239 @@
+#include "GaussNewtonSolver.h"
+#include "ConvergenceMonitor.h"
+#include "FiniteDifferences.h"
+#include "config.h"
+using namespace std;
+
+static double dotProduct(const vector<Eigen::Vector3d> &a, const vector<Eigen::Vector3d> &b)
+{
+  double sum = 0;
+  int n = a.size();
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for reduction(+ : sum)
+#endif
+  for (int i = 0; i < n; i++)
+    sum += a[i].dot(b[i]);
+  return sum;
+}
+
+GaussNewtonSolver::GaussNewtonSolver(const SDF *src,
+                                     const SDF *dest,
+                                     DisplacementField *srcToDest)
+    : m_src(src),
+      m_dest(dest),
+      m_srcToDest(srcToDest),
+      m_gridSize(src->getGridSize())
+{
+  m_gridSpacingPerAxis = Eigen::Vector3i(1, m_gridSize(0), m_gridSize(0) * m_gridSize(1));
+}
+
+void GaussNewtonSolver::solve()
+{
+  // Each outer iteration is judged by the same stopping rules as gradient descent.
+  ConvergenceMonitor monitor("Gauss-Newton", EnergyTypeUsed);
+  for (int iter = 0; iter < GAUSS_NEWTON_MAX_ITERATIONS; iter++)
+  {
+    buildNarrowBand();
+    int numUnknowns = m_bandVoxels.size();
+    if (numUnknowns == 0)
+      break;
+
+    linearize();
+    vector<Eigen::Vector3d> delta;
+    int cgIterations = solveConjugateGradient(delta);
+
+    vector<double> updateNorms(numUnknowns);
+    bool updateIsFinite = true;
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for reduction(&& : updateIsFinite)
+#endif
+    for (int i = 0; i < numUnknowns; i++)
+    {
+      updateIsFinite = updateIsFinite && delta[i].array().isFinite().all();
+      updateNorms[i] = delta[i].norm();
+      m_srcToDest->update(m_bandVoxels[i], delta[i]);
+    }
+
+    // perform check on deformation field to see if it has diverged. Ideally shouldn't happen
+    if (!updateIsFinite)
+    {
+      std::cout << "Error: deformation field has diverged in Gauss-Newton iteration " << iter << std::endl;
+      throw - 1;
+    }
+
+    cout << "Gauss-Newton step " << iter << " solved in " << cgIterations << " CG iterations" << endl;
+    IterationStatistics stats;
+    stats.iteration = iter;
+    stats.numActiveVoxels = numUnknowns;
+    ConvergenceMonitor::computeUpdateStatistics(updateNorms, stats);
+    if (monitor.isEnergyRequired())
+      monitor.computeEnergy(m_src, m_dest, m_srcToDest, stats);
+    if (monitor.hasConverged(stats))
+      break;
+  }
+}
+
+void GaussNewtonSolver::buildNarrowBand()
+{
+  int totalNumberOfVoxels = m_gridSize.prod();
+  m_bandIndex.assign(totalNumberOfVoxels, -1);
+
+  // Check in parallel if voxel is near the surface, and then number the unknowns serially to keep them in grid order.
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int z = 0; z < m_gridSize(2); z++)
+  {
+    for (int y = 0; y < m_gridSize(1); y++)
+    {
+      for (int x = 0; x < m_gridSize(0); x++)
+      {
+        double srcSdfDistance = m_src->getDistance(Eigen::Vector3i(x, y, z), m_srcToDest);
+        if (srcSdfDistance > MaxSurfaceVoxelDistance - epsilon || srcSdfDistance < -UnknownClipDistance)
+          continue;
+        m_bandIndex[z * m_gridSpacingPerAxis(2) + y * m_gridSpacingPerAxis(1) + x] = 0;
+      }
+    }
+  }
+
+  m_bandVoxels.clear();
+  for (int voxelIndex = 0; voxelIndex < totalNumberOfVoxels; voxelIndex++)
+  {
+    if (m_bandIndex[voxelIndex] < 0)
+      continue;
+    m_bandIndex[voxelIndex] = m_bandVoxels.size();
+    m_bandVoxels.push_back(Eigen::Vector3i(voxelIndex % m_gridSize(0),
+                                           (voxelIndex / m_gridSize(0)) % m_gridSize(1),
+                                           voxelIndex / m_gridSpacingPerAxis(2)));
+  }
+}
+
+void GaussNewtonSolver::linearize()
+{
+  int numUnknowns = m_bandVoxels.size();
+  m_gradient.resize(numUnknowns);
+  m_blockDiagonal.resize(numUnknowns);
+  m_preconditioner.resize(numUnknowns);
+
+  // Center coefficient of the Killing stencil. Laplacian contributes 6 and grad(div) contributes 2 * gammaKilling.
+  double killingDiagonal = EnergyTypeUsed[2] ? omegaKilling * 2 * (6 + 2 * gammaKilling) : 0;
+  auto getDisplacement = [this](int x, int y, int z) -> Eigen::Vector3d {
+    if (x < 0 || y < 0 || z < 0 || x >= m_gridSize(0) || y >= m_gridSize(1) || z >= m_gridSize(2))
+      return Eigen::Vector3d::Zero();
+    return m_srcToDest->getDisplacementAt(x, y, z);
+  };
+
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int i = 0; i < numUnknowns; i++)
+  {
+    const Eigen::Vector3i &spatialIndex = m_bandVoxels[i];
+    Eigen::Vector3d gradient = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d block = levenbergDamping * Eigen::Matrix3d::Identity();
+
+    if (EnergyTypeUsed[0] || EnergyTypeUsed[1])
+    {
+      Eigen::Vector3d distanceGradient = m_src->computeDistanceGradient(spatialIndex, m_srcToDest);
+      if (EnergyTypeUsed[0])
+      {
+        // Same scaling as KillingFusion::computeDataEnergyGradient, E = (srcDistance - destDistance)^2 / 2 * VoxelSize
+        double residual = (m_src->getDistance(spatialIndex, m_srcToDest) - m_dest->getDistanceAtIndex(spatialIndex)) / VoxelSize;
+        gradient += residual * distanceGradient;
+        block += distanceGradient * distanceGradient.transpose() / VoxelSize;
+      }
+      if (EnergyTypeUsed[1])
+      {
+        // E = omegaLevelSet * (|grad| - 1)^2 / 2, whose Jacobian is hessian * grad / |grad|
+        Eigen::Matrix3d hessian = m_src->computeDistanceHessian(spatialIndex, m_srcToDest);
+        double gradientNorm = distanceGradient.norm();
+        Eigen::Vector3d levelSetJacobian = hessian * distanceGradient / (gradientNorm + epsilon);
+        gradient += omegaLevelSet * levelSetJacobian * (gradientNorm - 1);
+        block += omegaLevelSet * levelSetJacobian * levelSetJacobian.transpose();
+      }
+    }
+    if (EnergyTypeUsed[2])
+      gradient += omegaKilling * FiniteDifferences<double>::applyKillingOperator(spatialIndex, getDisplacement);
+
+    m_gradient[i] = gradient;
+    m_blockDiagonal[i] = block;
+    m_preconditioner[i] = (block + killingDiagonal * Eigen::Matrix3d::Identity()).inverse();
+  }
+}
+
+void GaussNewtonSolver::applyNormalEquations(const vector<Eigen::Vector3d> &p, vector<Eigen::Vector3d> &Ap) const
+{
+  // Update is zero outside the narrow band.
+  auto getUpdate = [&](int x, int y, int z) -> Eigen::Vector3d {
+    if (x < 0 || y < 0 || z < 0 || x >= m_gridSize(0) || y >= m_gridSize(1) || z >= m_gridSize(2))
+      return Eigen::Vector3d::Zero();
+    int unknownIndex = m_bandIndex[z * m_gridSpacingPerAxis(2) + y * m_gridSpacingPerAxis(1) + x];
+    return unknownIndex < 0 ? Eigen::Vector3d::Zero() : p[unknownIndex];
+  };
+
+  int numUnknowns = m_bandVoxels.size();
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int i = 0; i < numUnknowns; i++)
+  {
+    Ap[i] = m_blockDiagonal[i] * p[i];
+    if (EnergyTypeUsed[2])
+      Ap[i] += omegaKilling * FiniteDifferences<double>::applyKillingOperator(m_bandVoxels[i], getUpdate);
+  }
+}
+
+int GaussNewtonSolver::solveConjugateGradient(vector<Eigen::Vector3d> &delta) const
+{
+  int numUnknowns = m_bandVoxels.size();
+  vector<Eigen::Vector3d> r(numUnknowns), z(numUnknowns), p(numUnknowns), Ap(numUnknowns);
+  delta.assign(numUnknowns, Eigen::Vector3d::Zero());
+
+  // delta starts at zero, thus r = -gradient - A * delta = -gradient.
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int i = 0; i < numUnknowns; i++)
+  {
+    r[i] = -m_gradient[i];
+    z[i] = m_preconditioner[i] * r[i];
+    p[i] = z[i];
+  }
+  double rz = dotProduct(r, z);
+  double initialResidualNorm = sqrt(dotProduct(r, r));
+  if (initialResidualNorm < epsilon)
+    return 0;
+
+  int iter = 0;
+  while (iter < CG_MAX_ITERATIONS)
+  {
+    applyNormalEquations(p, Ap);
+    double pAp = dotProduct(p, Ap);
+    if (pAp <= 0)
+      break;
+    double stepSize = rz / pAp;
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int i = 0; i < numUnknowns; i++)
+    {
+      delta[i] += stepSize * p[i];
+      r[i] -= stepSize * Ap[i];
+      z[i] = m_preconditioner[i] * r[i];
+    }
+    iter++;
+
+    if (sqrt(dotProduct(r, r)) < cgTolerance * initialResidualNorm)
+      break;
+
+    double rzNew = dotProduct(r, z);
+    double beta = rzNew / rz;
+    rz = rzNew;
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int i = 0; i < numUnknowns; i++)
+      p[i] = z[i] + beta * p[i];
+  }
+  return iter;
+}
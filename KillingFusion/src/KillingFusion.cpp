@@ -4,435 +4,560 @@
 
 #include "KillingFusion.h"
 #include "SDF.h"
-#include "Timer.h"
+#include "GaussNewtonSolver.h"
+#include "ConvergenceMonitor.h"
+#include "TiledSchedule.h"
+#include "DeformedSdfKernels.h"
+#include "AdaptiveStepSize.h"
+#include "ControlLattice.h"
+#include <algorithm>
 using namespace std;
 
 KillingFusion::KillingFusion(DatasetReader datasetReader)
-    : m_datasetReader(datasetReader),
-      m_canonicalSdf(nullptr)
+    : VariationalFusion(datasetReader)
 {
-  // Create a canonical SDF
-  int w = m_datasetReader.getDepthWidth();
-  int h = m_datasetReader.getDepthHeight();
-  double minDepth = m_datasetReader.getMinimumDepthThreshold();
-  double maxDepth = m_datasetReader.getMaximumDepthThreshold();
-  std::pair<Eigen::Vector3d, Eigen::Vector3d> frameBound = computeBounds(w, h, minDepth, maxDepth);
-  m_canonicalSdf = new SDF(VoxelSize,
-                           frameBound.first,
-                           frameBound.second,
-                           UnknownClipDistance);
-  cout << "Grid Size:" << m_canonicalSdf->getGridSize().transpose() << endl;
-  m_startFrame = 1;
-  m_endFrame = 99;
-  m_stride = 1;
-  m_currFrameIndex = m_startFrame;
-  m_prev2CanDisplacementField = nullptr;
 }
 
-KillingFusion::~KillingFusion()
+void KillingFusion::computeDisplacementField(const SDF *src,
+                                             const SDF *dest,
+                                             DisplacementField *srcToDest)
 {
-  // ToDo - Use Unique Ptr
-  if (m_canonicalSdf != nullptr)
-    delete m_canonicalSdf;
-  if (m_prev2CanDisplacementField != nullptr)
-    delete m_prev2CanDisplacementField;
-}
+  if (UseGaussNewton)
+  {
+    GaussNewtonSolver solver(src, dest, srcToDest);
+    solver.solve();
+    return;
+  }
 
-void KillingFusion::process()
-{
-  // Set the sequence of image to process
-  // int startFrame = 0;
-  int startFrame = 4;
-  int endFrame = 100;
-  // int endFrame = m_datasetReader.getNumImageFiles();
-
-  // Displacement Field for the previous and current frame.
-  DisplacementField *prev2CanDisplacementField, *curr2CanDisplacementField;
-
-  // Set prevSdf to SDF of first frame
-  const SDF *prevSdf = computeSDF(startFrame);
-  prev2CanDisplacementField = createZeroDisplacementField(*prevSdf);
-  m_canonicalSdf->fuse(prevSdf);
-
-  // Save Mesh of the SDF
-  string meshFileNames[4] = {"InputFrameSDF", "RegisteredFrameSDF", "CanonicalSDF", "LiveCanonicalSdf"};
-  prevSdf->save_mesh(meshFileNames[0], startFrame);
-  prevSdf->save_mesh(meshFileNames[1], startFrame);
-  prevSdf->save_mesh(meshFileNames[2], startFrame);
-  prevSdf->save_mesh(meshFileNames[3], startFrame);
-
-  Timer totalTimer, timer;
-  cout << "Frame  Compute SDF    KillingOptimize    Fuse SDF\n";
-  // For each image file from DatasetReader
-  for (int i = startFrame + 1; i < endFrame; ++i)
+  // Energy terms and update strategy stay the same for the whole frame. Pick the matching instantiation of the per-voxel
+  // kernels once here, instead of checking the config for each voxel in each iteration.
+  int energyTypes = EnergyTypeUsed[0] | EnergyTypeUsed[1] << 1 | EnergyTypeUsed[2] << 2;
+  switch (energyTypes)
   {
-    // Convert current frame to SDF - currSdf
-    timer.reset();
-    SDF *currSdf = computeSDF(i);
-    double sdfTime = timer.elapsed();
-    // Save SDF of Current Frame
-    currSdf->save_mesh(meshFileNames[0], i);
-
-    // Future Task - Implement SDF-2-SDF to register currSDF to prevSDF
-    // Future Task - ToDo - DisplacementField should have same shape as their SDF.
-    curr2CanDisplacementField = prev2CanDisplacementField;
-
-    // Compute Deformation Field for current frame SDF to merge with m_canonicalSdf
-    timer.reset();
-    computeDisplacementField(currSdf, m_canonicalSdf, curr2CanDisplacementField);
-    double killingTime = timer.elapsed();
-
-    // Save Registered SDF Current Frame
-    currSdf->save_mesh(meshFileNames[1], i, *curr2CanDisplacementField);
-
-    // Merge the m_currSdf to m_canonicalSdf using m_currSdf displacement field.
-    timer.reset();
-    m_canonicalSdf->fuse(currSdf, curr2CanDisplacementField);
-    double fuseTime = timer.elapsed();
-
-    // Save Canonical SDF
-    m_canonicalSdf->save_mesh(meshFileNames[2], i);
-
-    // ToDo - Render Live Canonical SDF registered towards CurrentFrame, inverse deformation field.
-
-    // Delete m_prevSdf and assign m_currSdf to m_prevSdf
-    delete prevSdf;
-    prevSdf = currSdf;
-    prev2CanDisplacementField = curr2CanDisplacementField;
-    printf("%03d\t%0.6fs\t%0.6fs\t%0.6fs\n", i, sdfTime, killingTime, fuseTime);
+  case 0:
+    dispatchUpdateStrategy<false, false, false>(src, dest, srcToDest);
+    break;
+  case 1:
+    dispatchUpdateStrategy<true, false, false>(src, dest, srcToDest);
+    break;
+  case 2:
+    dispatchUpdateStrategy<false, true, false>(src, dest, srcToDest);
+    break;
+  case 3:
+    dispatchUpdateStrategy<true, true, false>(src, dest, srcToDest);
+    break;
+  case 4:
+    dispatchUpdateStrategy<false, false, true>(src, dest, srcToDest);
+    break;
+  case 5:
+    dispatchUpdateStrategy<true, false, true>(src, dest, srcToDest);
+    break;
+  case 6:
+    dispatchUpdateStrategy<false, true, true>(src, dest, srcToDest);
+    break;
+  case 7:
+    dispatchUpdateStrategy<true, true, true>(src, dest, srcToDest);
+    break;
   }
-  cout << "Total time spent " << totalTimer.elapsed() << endl;
-  m_canonicalSdf->dumpToBinFile("FinalCanonicalModel.bin",
-                                UnknownClipDistance, 1.0);
 }
 
-vector<SimpleMesh *> KillingFusion::processNextFrame()
+template <bool DataEnergy, bool LevelSetEnergy, bool KillingEnergy, bool SinglePrecision>
+void KillingFusion::dispatchUpdateStrategy(const SDF *src,
+                                           const SDF *dest,
+                                           DisplacementField *srcToDest)
 {
-  vector<SimpleMesh *> meshes;
-
-  SimpleMesh *canonicalMesh = nullptr, *currentSdfMesh = nullptr, *currentFrameRegisteredSdfMesh = nullptr;
-
-  if (m_currFrameIndex == m_startFrame)
+  if (UseControlLattice)
   {
-    m_canonicalSdf = computeSDF(m_startFrame);
-    m_prev2CanDisplacementField = createZeroDisplacementField(*m_canonicalSdf);
-    currentSdfMesh = m_canonicalSdf->getMesh();
-    currentFrameRegisteredSdfMesh = m_canonicalSdf->getMesh(*m_prev2CanDisplacementField);
-    m_currFrameIndex += m_stride;
+    optimizeControlLattice<KillingEnergyPolicy<DataEnergy, LevelSetEnergy, KillingEnergy>>(src, dest, srcToDest);
+    return;
   }
-  else if (m_currFrameIndex < m_endFrame)
+  // Float kernels are used only by optimizeAllVoxels.
+  if (UseSinglePrecision && UpdateAllVoxelsInEachIter && !SinglePrecision)
   {
-    Timer totalTimer, timer;
-    totalTimer.reset();
-    cout << "Frame  Compute SDF    KillingOptimize    Fuse SDF    Total Time\n";
-    timer.reset();
-    // Convert current frame to SDF - currSdf
-    SDF *currSdf = computeSDF(m_currFrameIndex);
-    double sdfTime = timer.elapsed();
-
-    // Future Task - Implement SDF-2-SDF to register currSDF to prevSDF
-    // Future Task - ToDo - DisplacementField should have same shape as their SDF, thus should be generated by SDF object
-    DisplacementField *curr2CanDisplacementField;
-    if (UseZeroDisplacementFieldForNextFrame)
-    {
-      delete m_prev2CanDisplacementField;
-      curr2CanDisplacementField = createZeroDisplacementField(*currSdf);
-    }
-    else
-      curr2CanDisplacementField = m_prev2CanDisplacementField;
-
-    timer.reset();
-    // Compute Deformation Field for current frame SDF to merge with m_canonicalSdf
-    if (EnergyTypeUsed[0] || EnergyTypeUsed[1] || EnergyTypeUsed[2]) // For quick check on what happens if no energy is used.
-    {
-      computeDisplacementField(currSdf, m_canonicalSdf, curr2CanDisplacementField);
-      std::stringstream filenameStream;
-      filenameStream << OUTPUT_DIR << outputDir[datasetType] << std::setfill('0') << std::setw(3) << std::to_string(m_currFrameIndex) << ".bin";
-      curr2CanDisplacementField->dumpToBinFile(filenameStream.str());
-    }
-    double killingTime = timer.elapsed();
-
-    timer.reset();
-    // Merge the m_currSdf to m_canonicalSdf using m_currSdf displacement field.
-    currentSdfMesh = currSdf->getMesh();
-    currSdf->update(curr2CanDisplacementField);
-    m_canonicalSdf->fuse(currSdf);
-    currentFrameRegisteredSdfMesh = currSdf->getMesh();
-    double fuseTime = timer.elapsed();
-
-    // ToDo - Save Live Canonical SDF registered towards CurrentFrame
-    m_prev2CanDisplacementField = curr2CanDisplacementField;
-    delete currSdf;
-    double totalTime = totalTimer.elapsed();
-    printf("%03d\t%0.6fs\t%0.6fs\t%0.6fs\t%0.6fs\n", m_currFrameIndex, sdfTime, killingTime, fuseTime, totalTime);
-    m_currFrameIndex += m_stride;
+    dispatchUpdateStrategy<DataEnergy, LevelSetEnergy, KillingEnergy, true>(src, dest, srcToDest);
+    return;
   }
-  canonicalMesh = m_canonicalSdf->getMesh();
-  meshes.push_back(currentSdfMesh);
-  meshes.push_back(currentFrameRegisteredSdfMesh);
-  meshes.push_back(canonicalMesh);
-  return meshes;
+  // Trust strategy is valid only when Data Energy alone is used, else it folds to false. Adaptive step sizes replace it.
+  const bool TrustStrategy = DataEnergy && !LevelSetEnergy && !KillingEnergy;
+  const bool UseTrust = UseTrustStrategy && !UseAdaptiveStepSize;
+  if (!UpdateAllVoxelsInEachIter)
+    optimizeVoxelByVoxel<KillingEnergyPolicy<DataEnergy, LevelSetEnergy, KillingEnergy>>(src, dest, srcToDest);
+  else if (UsePreviousIterationDeformationField && UseTrust)
+    optimizeAllVoxels<KillingEnergyPolicy<DataEnergy, LevelSetEnergy, KillingEnergy, true, TrustStrategy, SinglePrecision>>(src, dest, srcToDest);
+  else if (UsePreviousIterationDeformationField)
+    optimizeAllVoxels<KillingEnergyPolicy<DataEnergy, LevelSetEnergy, KillingEnergy, true, false, SinglePrecision>>(src, dest, srcToDest);
+  else if (UseTrust)
+    optimizeAllVoxels<KillingEnergyPolicy<DataEnergy, LevelSetEnergy, KillingEnergy, false, TrustStrategy, SinglePrecision>>(src, dest, srcToDest);
+  else
+    optimizeAllVoxels<KillingEnergyPolicy<DataEnergy, LevelSetEnergy, KillingEnergy, false, false, SinglePrecision>>(src, dest, srcToDest);
 }
 
-void KillingFusion::processTest(int testType)
+vector<unsigned char> KillingFusion::selectChangedBricks(const SDF *src,
+                                                        const SDF *dest,
+                                                        const DisplacementField *srcToDest) const
 {
-  // Set prevSdf to SDF of first frame
-  vector<SDF> adjacentVoxelSDFs = SDF::getDataEnergyTestSample(VoxelSize, UnknownClipDistance);
-  DisplacementField *next2CanDisplacementField = createZeroDisplacementField(adjacentVoxelSDFs[1]);
-  if (testType == 1)
-  { // Test if fuse works when merging one SDF to itself
-    adjacentVoxelSDFs[0].dumpToBinFile("testType-1-outputSphere0.bin", UnknownClipDistance, 1.0f);
-    adjacentVoxelSDFs[1].dumpToBinFile("testType-1-outputSphere1.bin", UnknownClipDistance, 1.0f);
-    adjacentVoxelSDFs[0].fuse(&(adjacentVoxelSDFs[0]));
-    adjacentVoxelSDFs[0].dumpToBinFile("testType-1-outputSphere0MergedTo0.bin", UnknownClipDistance, 1.0f);
-  }
-  else if (testType == 2)
-  { // Test if fuse works when merging one SDF to another
-    adjacentVoxelSDFs[0].dumpToBinFile("testType-1-outputSphere0.bin", UnknownClipDistance, 1.0f);
-    adjacentVoxelSDFs[1].dumpToBinFile("testType-1-outputSphere1.bin", UnknownClipDistance, 1.0f);
-    adjacentVoxelSDFs[0].fuse(&(adjacentVoxelSDFs[1]));
-    adjacentVoxelSDFs[0].dumpToBinFile("testType-1-outputSphere1MergedTo0.bin", UnknownClipDistance, 1.0f);
-  }
-  else
+  Eigen::Vector3i srcGridSize = src->getGridSize();
+  Eigen::Vector3i numBricksPerAxis;
+  for (int i = 0; i < 3; i++)
+    numBricksPerAxis(i) = (srcGridSize(i) + RESIDUAL_BRICK_SIZE - 1) / RESIDUAL_BRICK_SIZE;
+  int numBricks = numBricksPerAxis.prod();
+
+  // Mean absolute data residual over the narrow band voxels of each brick, in voxels.
+  vector<unsigned char> isBrickChanged(numBricks, 0);
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int brick = 0; brick < numBricks; brick++)
   {
-    computeDisplacementField(&(adjacentVoxelSDFs[1]), &(adjacentVoxelSDFs[0]), next2CanDisplacementField);
-    adjacentVoxelSDFs[0].fuse(&(adjacentVoxelSDFs[1]), next2CanDisplacementField);
-    SDF srcCopy(adjacentVoxelSDFs[1]);
-    srcCopy.fuse(&(adjacentVoxelSDFs[1]), next2CanDisplacementField);
-    srcCopy.dumpToBinFile("testType-2-outputSphere1Deformed.bin", UnknownClipDistance, 1.0f);
-    adjacentVoxelSDFs[0].dumpToBinFile("testType-2-outputSphere1MergedTo0UsingKilling.bin", UnknownClipDistance, 1.0f);
+    Eigen::Vector3i brickBegin(brick % numBricksPerAxis(0),
+                               (brick / numBricksPerAxis(0)) % numBricksPerAxis(1),
+                               brick / (numBricksPerAxis(0) * numBricksPerAxis(1)));
+    brickBegin *= RESIDUAL_BRICK_SIZE;
+    Eigen::Vector3i brickEnd = (brickBegin.array() + RESIDUAL_BRICK_SIZE).min(srcGridSize.array());
+    double residualSum = 0;
+    int numBandVoxels = 0;
+    for (int z = brickBegin(2); z < brickEnd(2); z++)
+    {
+      for (int y = brickBegin(1); y < brickEnd(1); y++)
+      {
+        for (int x = brickBegin(0); x < brickEnd(0); x++)
+        {
+          const Eigen::Vector3i spatialIndex(x, y, z);
+          double srcSdfDistance = src->getDistance(spatialIndex, srcToDest);
+          if (srcSdfDistance > MaxSurfaceVoxelDistance - epsilon || srcSdfDistance < -UnknownClipDistance)
+            continue;
+          residualSum += fabs(srcSdfDistance - dest->getDistanceAtIndex(spatialIndex)) / VoxelSize;
+          numBandVoxels++;
+        }
+      }
+    }
+    isBrickChanged[brick] = numBandVoxels > 0 && residualSum / numBandVoxels > residualBrickThreshold;
   }
 
-  delete next2CanDisplacementField;
-}
-
-// SDF λ˾ǵλµSDFϵ½
-// ԭгģGiven a new depth frame Dn, we register it
-// Ϊû׼ҲǵºcomputeDisplacementField޷һҪԭ򡣵ȫ
-// to the previous one and obtain an estimate of its pose relative to the global model.
-SDF *KillingFusion::computeSDF(int frameIndex)
-{
-  // ToDo: SDF class should compute itself
-  // This will cause issue. SDF of Different Frames will be of different size.
-  // This will cause deformation field to be of different size.
-  // You then cannot simply set curr2PrevDisplacementField = prev2CanDisplacementField
-  int w = m_datasetReader.getDepthWidth();
-  int h = m_datasetReader.getDepthHeight();
-  double minDepth = m_datasetReader.getMinimumDepthThreshold();
-  double maxDepth = m_datasetReader.getMaximumDepthThreshold();
-  std::pair<Eigen::Vector3d, Eigen::Vector3d> frameBound = computeBounds(w, h, minDepth, maxDepth);
-  SDF *sdf = new SDF(VoxelSize,
-                     frameBound.first,
-                     frameBound.second,
-                     UnknownClipDistance);
-  std::vector<cv::Mat> cdoImages = m_datasetReader.getImages(frameIndex);
-  sdf->integrateDepthFrame(cdoImages.at(1),
-                           Eigen::Matrix4d::Identity(),
-                           m_datasetReader.getDepthIntrinsicMatrix(),
-                           minDepth,
-                           maxDepth);
-  return sdf;
-}
-
-DisplacementField *KillingFusion::createZeroDisplacementField(const SDF &sdf)
-{
-  DisplacementField *displacementField = new DisplacementField(sdf.getGridSize(), VoxelSize);
-  // displacementField->initializeAllVoxels(Eigen::Vector3d(-m_currFrameIndex/5, 0, 0)); // To check if deformation field works. It does.
-  return displacementField;
+  // Changed bricks with their halo. Voxels just outside a brick read its displacement through the stencils.
+  vector<unsigned char> isChanged(srcGridSize.prod(), 0);
+  int numChangedBricks = 0;
+  for (int brick = 0; brick < numBricks; brick++)
+  {
+    if (!isBrickChanged[brick])
+      continue;
+    numChangedBricks++;
+    Eigen::Vector3i brickBegin(brick % numBricksPerAxis(0),
+                               (brick / numBricksPerAxis(0)) % numBricksPerAxis(1),
+                               brick / (numBricksPerAxis(0) * numBricksPerAxis(1)));
+    brickBegin *= RESIDUAL_BRICK_SIZE;
+    Eigen::Vector3i haloBegin = (brickBegin.array() - RESIDUAL_BRICK_HALO).max(0);
+    Eigen::Vector3i haloEnd = (brickBegin.array() + RESIDUAL_BRICK_SIZE + RESIDUAL_BRICK_HALO).min(srcGridSize.array());
+    for (int z = haloBegin(2); z < haloEnd(2); z++)
+      for (int y = haloBegin(1); y < haloEnd(1); y++)
+        for (int x = haloBegin(0); x < haloEnd(0); x++)
+          isChanged[z * srcGridSize(0) * srcGridSize(1) + y * srcGridSize(0) + x] = 1;
+  }
+  cout << "Re-optimizing " << numChangedBricks << " of " << numBricks << " bricks" << endl;
+  return isChanged;
 }
 
-void KillingFusion::computeDisplacementField(const SDF *src,
-                                             const SDF *dest,
-                                             DisplacementField *srcToDest)
+// ȷļ㷽ǲҪ޸
+template <typename Policy>
+void KillingFusion::optimizeAllVoxels(const SDF *src,
+                                      const SDF *dest,
+                                      DisplacementField *srcToDest)
 {
   // ToDo: Use Cuda.
   // Process at each voxel location
   Eigen::Vector3i srcGridSize = src->getGridSize();
 
-  if (UpdateAllVoxelsInEachIter) //ȷļ㷽ǲҪ޸
+  // Jacobi update visits all voxels at once. In place update is a Gauss-Seidel sweep over 8 colors by parity of
+  // (x, y, z). Energy gradient of a voxel reads displacement only within 1 voxel, thus voxels of one color can be
+  // updated in parallel, without a race and with same result for any number of threads.
+  int numColors = Policy::JacobiUpdate ? 1 : 8;
+  auto getColor = [numColors](int x, int y, int z) {
+    return numColors == 1 ? 0 : (x & 1) | (y & 1) << 1 | (z & 1) << 2;
+  };
+
+  // Voxels visited in next iteration, per color and in grid order. Initially all voxels are active, or only those of
+  // the bricks that still disagree with dest after the warm start.
+  int totalNumberOfVoxels = srcGridSize.prod();
+  vector<unsigned char> isChanged;
+  if (UseResidualBricks)
+    isChanged = selectChangedBricks(src, dest, srcToDest);
+  vector<vector<int>> activeVoxels(numColors);
+  for (int z = 0; z < srcGridSize(2); z++)
+    for (int y = 0; y < srcGridSize(1); y++)
+      for (int x = 0; x < srcGridSize(0); x++)
+      {
+        int voxelIndex = z * srcGridSize(0) * srcGridSize(1) + y * srcGridSize(0) + x;
+        if (!UseResidualBricks || isChanged[voxelIndex])
+          activeVoxels[getColor(x, y, z)].push_back(voxelIndex);
+      }
+  vector<unsigned char> isNextActive(totalNumberOfVoxels, 0);
+  vector<double> voxelUpdateNorm(totalNumberOfVoxels, -1); // -1 if voxel was not updated in this iteration.
+
+  const bool energyTypeUsed[3] = {Policy::UseDataEnergy, Policy::UseLevelSetEnergy, Policy::UseKillingEnergy};
+  // Adaptive steps keep their size near the minimum and overshoot it, thus energy decides when to stop.
+  ConvergenceMonitor monitor("Killing", energyTypeUsed, UseAdaptiveStepSize);
+  TiledSchedule tiledSchedule(srcGridSize, TILE_SIZE);
+
+  // Float copy read by the per-voxel kernels. srcToDest stays the double field that accumulates the updates, each
+  // update is copied back into the float field.
+  DeformedSdfKernels<float> *floatKernels = nullptr;
+  if (Policy::SinglePrecision)
+    floatKernels = new DeformedSdfKernels<float>(src, dest, srcToDest);
+  AdaptiveStepSize *adaptiveStepSize = nullptr;
+  if (UseAdaptiveStepSize)
+    adaptiveStepSize = new AdaptiveStepSize(totalNumberOfVoxels);
+
+  // Make one update for each voxel at a time.
+  for (size_t iter = 0; iter < KILLING_MAX_ITERATIONS; iter++)
   {
-    // Make one update for each voxel at a time.
-    for (size_t iter = 0; iter < KILLING_MAX_ITERATIONS; iter++)
-    {
-      // std::cout << iter << std::endl;
-      DisplacementField *currIterDeformation = nullptr;
-	  double maxVectorUpdateNorm = 0;
+    // std::cout << iter << std::endl;
+    DisplacementField *currIterDeformation = nullptr;
 	  //ԣʵ½һյʱԴ洢vox wiseݶȸ£ÿvox wizeʹһͳһ
 	  // õα䳡srcToDestȫvoxɺ󣬰ʱα䳡ͳһµһα䳡srcToDestϡ
-      if (UsePreviousIterationDeformationField)  //
-        currIterDeformation = createZeroDisplacementField(*src);  
+    if (Policy::JacobiUpdate)  //
+      currIterDeformation = createZeroDisplacementField(*src);  
+
+    for (int color = 0; color < numColors; color++)
+    {
+      // Voxels of one color are 2 voxels apart along each axis, thus none of them reads another ones displacement.
+      // Non-empty tiles are handed out dynamically, as the narrow band fills them unevenly.
+      tiledSchedule.build(activeVoxels[color]);
+      int numTiles = tiledSchedule.getNumTiles();
 #ifndef DISABLE_OPENMP
 #pragma omp parallel for schedule(dynamic)
 #endif
-      for (int z = 0; z < srcGridSize(2); z++)
+      for (int tile = 0; tile < numTiles; tile++)
       {
-        for (int y = 0; y < srcGridSize(1); y++)
+        for (int i = tiledSchedule.getTileBegin(tile); i < tiledSchedule.getTileEnd(tile); i++)
         {
-          for (int x = 0; x < srcGridSize(0); x++)
-          {
-            // if (iter == 6 && x == 42 && y == 36 && z == 29)
-            //   cout << "Check";
-            // Actual 3D Point on Desination Grid, where to optimize for.
-            const Eigen::Vector3i spatialIndex(x, y, z);
+          int voxelIndex = tiledSchedule.getVoxelIndex(i);
+          int x = voxelIndex % srcGridSize(0);
+          int y = (voxelIndex / srcGridSize(0)) % srcGridSize(1);
+          int z = voxelIndex / (srcGridSize(0) * srcGridSize(1));
+          // if (iter == 6 && x == 42 && y == 36 && z == 29)
+          //   cout << "Check";
+          // Actual 3D Point on Desination Grid, where to optimize for.
+          const Eigen::Vector3i spatialIndex(x, y, z);
 
-            // Check if srcGridLocation is near the Surface.
-            double srcSdfDistance = src->getDistance(spatialIndex, srcToDest);
-            if (srcSdfDistance > MaxSurfaceVoxelDistance - epsilon || srcSdfDistance < -UnknownClipDistance)
-              continue;
+          // Check if srcGridLocation is near the Surface.
+          double srcSdfDistance = Policy::SinglePrecision ? floatKernels->getDeformedDistance(spatialIndex)
+                                                          : src->getDistance(spatialIndex, srcToDest);
+          if (srcSdfDistance > MaxSurfaceVoxelDistance - epsilon || srcSdfDistance < -UnknownClipDistance)
+            continue;
 
 #ifdef MY_DEBUG
-            double origSrcSdfDistance = srcSdfDistance;
-            cout << x << "," << y << ", " << z << endl;
-            cout << "OrigDist|       Src Dist        |   Dest dist   |                  Delta Change              | New Displacement \n";
-            const Eigen::IOFormat fmt(4, 0, "\t", " ", "", "", "", "");
-            double destSdfDistance = dest->getDistanceAtIndex(spatialIndex);
+          double origSrcSdfDistance = srcSdfDistance;
+          cout << x << "," << y << ", " << z << endl;
+          cout << "OrigDist|       Src Dist        |   Dest dist   |                  Delta Change              | New Displacement \n";
+          const Eigen::IOFormat fmt(4, 0, "\t", " ", "", "", "", "");
+          double destSdfDistance = dest->getDistanceAtIndex(spatialIndex);
 #endif
 
-            // Optimize All Energies between Source Grid and Desination Grid
-            Eigen::Vector3d gradient = computeEnergyGradient(src, dest, srcToDest, spatialIndex);
-            Eigen::Vector3d displacementUpdate = -alpha * gradient; //ǰصα
-
-			maxVectorUpdateNorm = max(maxVectorUpdateNorm,displacementUpdate.norm());
-
-            // Trust Region Strategy - Valid only when Data Energy is used.
-            if (UseTrustStrategy && EnergyTypeUsed[0] && !EnergyTypeUsed[1] && !EnergyTypeUsed[2])
+          // Optimize All Energies between Source Grid and Desination Grid
+          Eigen::Vector3d gradient = Policy::SinglePrecision
+                                         ? floatKernels->computeEnergyGradient<Policy>(spatialIndex, srcSdfDistance).template cast<double>()
+                                         : computeEnergyGradient<Policy>(src, dest, srcToDest, spatialIndex, srcSdfDistance);
+          // Adaptive steps are normalised, thus convergence is judged by the plain gradient step instead.
+          double updateNorm = 0;
+          Eigen::Vector3d displacementUpdate = UseAdaptiveStepSize ? adaptiveStepSize->computeUpdate(voxelIndex, gradient, updateNorm)
+                                                                   : Eigen::Vector3d(-alpha * gradient); //ǰصα
+
+          // Trust Region Strategy - Valid only when Data Energy is used.
+          if (Policy::TrustStrategy)
+          {
+            double _alpha = alpha;
+            bool lossDecreased = false;
+            double destSdfDistance = dest->getDistanceAtIndex(spatialIndex);
+            double prevSrcSdfDistance = src->getDistance(spatialIndex, srcToDest);
+            do
             {
-              double _alpha = alpha;
-              bool lossDecreased = false;
-              double destSdfDistance = dest->getDistanceAtIndex(spatialIndex);
-              double prevSrcSdfDistance = src->getDistance(spatialIndex, srcToDest);
-              do
+              srcSdfDistance = src->getDistance(spatialIndex.cast<double>() + srcToDest->getDisplacementAt(spatialIndex) + displacementUpdate + Eigen::Vector3d(0.5, 0.5, 0.5));
+              double sdfDistanceConverged = fabs(srcSdfDistance - destSdfDistance) - fabs(prevSrcSdfDistance - destSdfDistance);
+              if (sdfDistanceConverged > 0)
               {
-                srcSdfDistance = src->getDistance(spatialIndex.cast<double>() + srcToDest->getDisplacementAt(spatialIndex) + displacementUpdate + Eigen::Vector3d(0.5, 0.5, 0.5));
-                double sdfDistanceConverged = fabs(srcSdfDistance - destSdfDistance) - fabs(prevSrcSdfDistance - destSdfDistance);
-                if (sdfDistanceConverged > 0)
-                {
-                  _alpha /= 1.5;
+                _alpha /= 1.5;
 #ifdef MY_DEBUG
-                  cout << "Changed alpha to " << _alpha << endl;
+                cout << "Changed alpha to " << _alpha << endl;
 #endif
-                  displacementUpdate = -_alpha * gradient;
-                }
-                else
-                {
-                  lossDecreased = true;
-                }
-              } while (!lossDecreased && _alpha > 1e-7);
-              if (_alpha < 1e-7)
-                break;
-            }
+                displacementUpdate = -_alpha * gradient;
+              }
+              else
+              {
+                lossDecreased = true;
+              }
+            } while (!lossDecreased && _alpha > 1e-7);
+            if (_alpha < 1e-7)
+              continue;
+          }
 
-            if (UsePreviousIterationDeformationField) // ڵǰظʱα䳡ģӰص
-              currIterDeformation->update(spatialIndex, displacementUpdate);
-            else
-              srcToDest->update(spatialIndex, displacementUpdate);
+          if (Policy::JacobiUpdate) // ڵǰظʱα䳡ģӰص
+            currIterDeformation->update(spatialIndex, displacementUpdate);
+          else
+            srcToDest->update(spatialIndex, displacementUpdate);
+          if (Policy::SinglePrecision && !Policy::JacobiUpdate)
+            floatKernels->setDisplacement(voxelIndex, srcToDest->getDisplacementAt(spatialIndex));
+          voxelUpdateNorm[voxelIndex] = UseAdaptiveStepSize ? updateNorm : displacementUpdate.norm();
 
 #ifdef MY_DEBUG
-            srcSdfDistance = src->getDistance(spatialIndex, srcToDest);
-            cout << origSrcSdfDistance << "\t|\t" << srcSdfDistance << "\t|\t" << destSdfDistance << "\t|\t"
-                 << displacementUpdate.transpose().format(fmt) << "\t|\t" << srcToDest->getDisplacementAt(spatialIndex).transpose().format(fmt) << "\n";
+          srcSdfDistance = src->getDistance(spatialIndex, srcToDest);
+          cout << origSrcSdfDistance << "\t|\t" << srcSdfDistance << "\t|\t" << destSdfDistance << "\t|\t"
+               << displacementUpdate.transpose().format(fmt) << "\t|\t" << srcToDest->getDisplacementAt(spatialIndex).transpose().format(fmt) << "\n";
 #endif
 
-            // perform check on deformation field to see if it has diverged. Ideally shouldn't happen
-            if (!srcToDest->getDisplacementAt(spatialIndex).array().isFinite().all())
-            {
-              std::cout << "Error: deformation field has diverged: " << srcToDest->getDisplacementAt(spatialIndex) << " at: " << spatialIndex << std::endl;
-              throw - 1;
-            }
+          // perform check on deformation field to see if it has diverged. Ideally shouldn't happen
+          if (!srcToDest->getDisplacementAt(spatialIndex).array().isFinite().all())
+          {
+            std::cout << "Error: deformation field has diverged: " << srcToDest->getDisplacementAt(spatialIndex) << " at: " << spatialIndex << std::endl;
+            throw - 1;
+          }
 
 #ifdef MY_DEBUG
-            cout << "OrigDist|       Src Dist        |   Dest dist   |                  Delta Change              | New Displacement \n";
-            cout << origSrcSdfDistance << "\t|\t" << srcSdfDistance << "\t|\t" << destSdfDistance << "\t|\t"
-                 << displacementUpdate.transpose().format(fmt) << "\t|\t" << srcToDest->getDisplacementAt(spatialIndex).transpose().format(fmt) << "\n";
-            cout << x << "," << y << ", " << z << endl;
-            cout << endl;
-            char c;
-            cin >> c; // wait for user to read the inputs.
+          cout << "OrigDist|       Src Dist        |   Dest dist   |                  Delta Change              | New Displacement \n";
+          cout << origSrcSdfDistance << "\t|\t" << srcSdfDistance << "\t|\t" << destSdfDistance << "\t|\t"
+               << displacementUpdate.transpose().format(fmt) << "\t|\t" << srcToDest->getDisplacementAt(spatialIndex).transpose().format(fmt) << "\n";
+          cout << x << "," << y << ", " << z << endl;
+          cout << endl;
+          char c;
+          cin >> c; // wait for user to read the inputs.
 #endif
-          }
         }
       }
-      if (UsePreviousIterationDeformationField)
-      {
+    }
+    if (Policy::JacobiUpdate)
+    {
 		//ؼɺ󣬰ʱα䳡αͳһµԭα䳡ϡ
-        *srcToDest = *srcToDest + *currIterDeformation;
-        delete currIterDeformation;
+      *srcToDest += *currIterDeformation;
+      delete currIterDeformation;
+      if (Policy::SinglePrecision)
+        floatKernels->copyDisplacementField(*srcToDest);
+    }
+
+    // Collect update norms of the voxels updated in this iteration, and reset them for the next one.
+    IterationStatistics stats;
+    stats.iteration = iter;
+    vector<double> updateNorms;
+    vector<int> movedVoxels;
+    for (const vector<int> &colorVoxels : activeVoxels)
+    {
+      stats.numActiveVoxels += colorVoxels.size();
+      for (int voxelIndex : colorVoxels)
+      {
+        if (voxelUpdateNorm[voxelIndex] < 0)
+          continue;
+        updateNorms.push_back(voxelUpdateNorm[voxelIndex]);
+        if (voxelUpdateNorm[voxelIndex] >= activeSetThreshold)
+          movedVoxels.push_back(voxelIndex);
+        voxelUpdateNorm[voxelIndex] = -1;
+      }
+    }
+    ConvergenceMonitor::computeUpdateStatistics(updateNorms, stats);
+    if (monitor.isEnergyRequired())
+      monitor.computeEnergy(src, dest, srcToDest, stats);
+
+    // Shrink the active set. A voxel is frozen when neither it nor any of its 26 neighbours moved more than
+    // activeSetThreshold. This is an approximation - neighbours moving by less still change its gradient, and its own
+    // small updates are no longer applied until a neighbour thaws it. Neighbours of a moved voxel are thawed.
+    int numActiveVoxels = 0;
+    if (UseActiveSet)
+    {
+      vector<vector<int>> nextActiveVoxels(numColors);
+      for (int voxelIndex : movedVoxels)
+      {
+        int x = voxelIndex % srcGridSize(0);
+        int y = (voxelIndex / srcGridSize(0)) % srcGridSize(1);
+        int z = voxelIndex / (srcGridSize(0) * srcGridSize(1));
+        for (int nz = max(z - 1, 0); nz <= min(z + 1, srcGridSize(2) - 1); nz++)
+          for (int ny = max(y - 1, 0); ny <= min(y + 1, srcGridSize(1) - 1); ny++)
+            for (int nx = max(x - 1, 0); nx <= min(x + 1, srcGridSize(0) - 1); nx++)
+            {
+              int neighbourIndex = nz * srcGridSize(0) * srcGridSize(1) + ny * srcGridSize(0) + nx;
+              if (isNextActive[neighbourIndex])
+                continue;
+              isNextActive[neighbourIndex] = 1;
+              nextActiveVoxels[getColor(nx, ny, nz)].push_back(neighbourIndex);
+            }
+      }
+      for (vector<int> &colorVoxels : nextActiveVoxels)
+      {
+        sort(colorVoxels.begin(), colorVoxels.end());
+        for (int voxelIndex : colorVoxels)
+          isNextActive[voxelIndex] = 0;
+        numActiveVoxels += colorVoxels.size();
       }
+      activeVoxels.swap(nextActiveVoxels);
+    }
 	  //ûеǰֹĻƣߣRegistration is terminated when the magnitude of the maximum vector update
 	  // in  falls below a threshold of 0.1 mm. ֹ
 	  // ʵ֤ԭҪ޸bug
-	  cout << ":" << iter << ":" << maxVectorUpdateNorm << endl;
-	  if (maxVectorUpdateNorm < 0.1 / 1000) {
-		  cout << ":" << iter << endl;
-		  break;
-	  }
+    if (monitor.hasConverged(stats))
+      break;
+    if (UseActiveSet && numActiveVoxels == 0)
+    {
+      cout << "All voxels frozen at iteration " << iter << endl;
+      break;
     }
   }
-  else
+  delete floatKernels;
+  delete adaptiveStepSize;
+}
+
+template <typename Policy>
+void KillingFusion::optimizeControlLattice(const SDF *src,
+                                           const SDF *dest,
+                                           DisplacementField *srcToDest)
+{
+  // Killing energy is evaluated on the lattice, thus voxels only add their Data and LevelSet gradient.
+  typedef KillingEnergyPolicy<Policy::UseDataEnergy, Policy::UseLevelSetEnergy, false> VoxelPolicy;
+  Eigen::Vector3i srcGridSize = src->getGridSize();
+  int totalNumberOfVoxels = srcGridSize.prod();
+  ControlLattice lattice(srcGridSize, CONTROL_LATTICE_SPACING);
+  int numControlPoints = lattice.getNumControlPoints();
+  int numBlocks = lattice.getNumBlocks();
+
+  vector<Eigen::Vector3d> voxelGradient(totalNumberOfVoxels), controlGradient, controlUpdate(numControlPoints);
+  vector<double> controlWeight;
+  // All blocks are checked for the narrow band first. Later on, only the blocks within one block of the band are, as
+  // the band moves by less than a block per iteration.
+  vector<unsigned char> isBlockActive(numBlocks, 1), isBlockInBand(numBlocks), isControlPointUpdated(numControlPoints);
+  const bool energyTypeUsed[3] = {Policy::UseDataEnergy, Policy::UseLevelSetEnergy, Policy::UseKillingEnergy};
+  ConvergenceMonitor monitor("ControlLattice", energyTypeUsed);
+
+  for (int iter = 0; iter < KILLING_MAX_ITERATIONS; iter++)
   {
+    // Energy gradient of each voxel of the narrow band, on the current field.
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int block = 0; block < numBlocks; block++)
+    {
+      isBlockInBand[block] = 0;
+      if (!isBlockActive[block])
+        continue;
+      Eigen::Vector3i begin, end;
+      lattice.getBlockBounds(block, begin, end);
+      for (int z = begin(2); z < end(2); z++)
+      {
+        for (int y = begin(1); y < end(1); y++)
+        {
+          for (int x = begin(0); x < end(0); x++)
+          {
+            const Eigen::Vector3i spatialIndex(x, y, z);
+            int voxelIndex = z * srcGridSize(0) * srcGridSize(1) + y * srcGridSize(0) + x;
+            voxelGradient[voxelIndex].setZero();
+            double srcSdfDistance = src->getDistance(spatialIndex, srcToDest);
+            if (srcSdfDistance > MaxSurfaceVoxelDistance - epsilon || srcSdfDistance < -UnknownClipDistance)
+              continue;
+            isBlockInBand[block] = 1;
+            voxelGradient[voxelIndex] = computeEnergyGradient<VoxelPolicy>(src, dest, srcToDest, spatialIndex, srcSdfDistance);
+          }
+        }
+      }
+    }
+
+    // A control point moves by the weighted mean gradient of the voxels it carries, so that alpha keeps the meaning
+    // it has for a single voxel.
+    lattice.accumulateGradient(voxelGradient, isBlockActive, controlGradient, controlWeight);
+    IterationStatistics stats;
+    stats.iteration = iter;
+    vector<double> updateNorms;
+    bool updateIsFinite = true;
+    for (int i = 0; i < numControlPoints; i++)
+    {
+      controlUpdate[i].setZero();
+      isControlPointUpdated[i] = controlWeight[i] > 0;
+      if (!isControlPointUpdated[i])
+        continue;
+      Eigen::Vector3d gradient = controlGradient[i] / controlWeight[i];
+      if (Policy::UseKillingEnergy)
+        gradient += omegaKilling * lattice.computeKillingEnergyGradient(i);
+      controlUpdate[i] = -alpha * gradient;
+      updateIsFinite = updateIsFinite && controlUpdate[i].array().isFinite().all();
+      updateNorms.push_back(controlUpdate[i].norm());
+    }
+    // perform check on deformation field to see if it has diverged. Ideally shouldn't happen
+    if (!updateIsFinite)
+    {
+      std::cout << "Error: control lattice has diverged in iteration " << iter << std::endl;
+      throw - 1;
+    }
+    // Only the voxels carried by an updated control point move, and only the blocks within one block of the band
+    // need their gradient next iteration.
+    lattice.update(controlUpdate, lattice.getCarriedBlocks(isControlPointUpdated), srcToDest);
+    isBlockActive = lattice.dilateBlocks(isBlockInBand);
+
+    stats.numActiveVoxels = updateNorms.size();
+    ConvergenceMonitor::computeUpdateStatistics(updateNorms, stats);
+    if (monitor.isEnergyRequired())
+      monitor.computeEnergy(src, dest, srcToDest, stats);
+    if (monitor.hasConverged(stats))
+      break;
+  }
+}
+
+template <typename Policy>
+void KillingFusion::optimizeVoxelByVoxel(const SDF *src,
+                                         const SDF *dest,
+                                         DisplacementField *srcToDest)
+{
+  Eigen::Vector3i srcGridSize = src->getGridSize();
 	//ÿؽеֱٵڶأӦǴģӦҪͳһǲŶ
 
 #ifndef MY_DEBUG
 #pragma omp parallel for schedule(dynamic)
 #endif
-    for (int z = 0; z < srcGridSize(2); z++)
+  for (int z = 0; z < srcGridSize(2); z++)
+  {
+    for (int y = 0; y < srcGridSize(1); y++)
     {
-      for (int y = 0; y < srcGridSize(1); y++)
+      for (int x = 0; x < srcGridSize(0); x++)
       {
-        for (int x = 0; x < srcGridSize(0); x++)
+        // Actual 3D Point on Desination Grid, where to optimize for.
+        const Eigen::Vector3i spatialIndex(x, y, z);
+
+        // Check if srcGridLocation is near the Surface.
+        double srcSdfDistance = src->getDistance(spatialIndex, srcToDest);
+        if (srcSdfDistance > MaxSurfaceVoxelDistance - epsilon || srcSdfDistance < -MaxSurfaceVoxelDistance+epsilon)
+          continue;
+
+        // Optimize Killing Energy between Source Grid and Desination Grid
+        Eigen::Vector3d gradient;
+        int iter = 0;
+        do
         {
-          // Actual 3D Point on Desination Grid, where to optimize for.
-          const Eigen::Vector3i spatialIndex(x, y, z);
+          gradient = computeEnergyGradient<Policy>(src, dest, srcToDest, spatialIndex, src->getDistance(spatialIndex, srcToDest));
+          Eigen::Vector3d displacementUpdate = -alpha * gradient;
+          srcToDest->update(spatialIndex, displacementUpdate);
 
-          // Check if srcGridLocation is near the Surface.
-          double srcSdfDistance = src->getDistance(spatialIndex, srcToDest);
-          if (srcSdfDistance > MaxSurfaceVoxelDistance - epsilon || srcSdfDistance < -MaxSurfaceVoxelDistance+epsilon)
-            continue;
+          if (displacementUpdate.norm() <= threshold)
+            break;
 
-          // Optimize Killing Energy between Source Grid and Desination Grid
-          Eigen::Vector3d gradient;
-          int iter = 0;
-          do
+          // perform check on deformation field to see if it has diverged. Ideally shouldn't happen
+          if (!srcToDest->getDisplacementAt(spatialIndex).array().isFinite().all())
           {
-            gradient = computeEnergyGradient(src, dest, srcToDest, spatialIndex);
-            Eigen::Vector3d displacementUpdate = -alpha * gradient;
-            srcToDest->update(spatialIndex, displacementUpdate);
-
-            if (displacementUpdate.norm() <= threshold)
-              break;
-
-            // perform check on deformation field to see if it has diverged. Ideally shouldn't happen
-            if (!srcToDest->getDisplacementAt(spatialIndex).array().isFinite().all())
-            {
-              std::cout << "Error: deformation field has diverged: " << srcToDest->getDisplacementAt(spatialIndex) << " at: " << spatialIndex << std::endl;
-              throw - 1;
-            }
+            std::cout << "Error: deformation field has diverged: " << srcToDest->getDisplacementAt(spatialIndex) << " at: " << spatialIndex << std::endl;
+            throw - 1;
+          }
 
-            iter += 1;
-          } while (gradient.norm() > threshold && iter < KILLING_MAX_ITERATIONS);
-        }
+          iter += 1;
+        } while (gradient.norm() > threshold && iter < KILLING_MAX_ITERATIONS);
       }
     }
   }
 }
 
 // ͨʽ8910õʽ1ݶ
+template <typename Policy>
 Eigen::Vector3d KillingFusion::computeEnergyGradient(const SDF *src,
                                                      const SDF *dest,
                                                      const DisplacementField *srcDisplacementField,
-                                                     const Eigen::Vector3i &spatialIndex)
+                                                     const Eigen::Vector3i &spatialIndex,
+                                                     double srcSdfDistance)
 {
   Eigen::Vector3d data_grad(0, 0, 0), levelset_grad(0, 0, 0), killing_grad(0, 0, 0);
 
-  if (EnergyTypeUsed[0])
-  {
-    data_grad = computeDataEnergyGradient(src, dest, srcDisplacementField, spatialIndex);
-  }
-  if (EnergyTypeUsed[1])
-  {
-    levelset_grad = computeLevelSetEnergyGradient(src, dest, srcDisplacementField, spatialIndex) * omegaLevelSet;
-  }
-  if (EnergyTypeUsed[2])
+  computeDataAndLevelSetEnergyGradient(src, dest, srcDisplacementField, spatialIndex, srcSdfDistance,
+                                       Policy::UseDataEnergy, Policy::UseLevelSetEnergy, data_grad, levelset_grad);
+  if (Policy::UseKillingEnergy)
   {
     killing_grad = computeKillingEnergyGradient(srcDisplacementField, spatialIndex) * omegaKilling;
   }
@@ -462,82 +587,9 @@ Eigen::Vector3d KillingFusion::computeEnergyGradient(const SDF *src,
   return (data_grad + killing_grad + levelset_grad);
 }
 
-Eigen::Vector3d KillingFusion::computeDataEnergyGradient(const SDF *src,
-                                                         const SDF *dest,
-                                                         const DisplacementField *srcDisplacementField,
-                                                         const Eigen::Vector3i &spatialIndex)
-{
-  Eigen::Vector3d srcPointDistanceGradient = src->computeDistanceGradient(spatialIndex, srcDisplacementField);
-  // if (srcPointDistanceGradient.norm() > 1e-3) // Do not normalize when near 0
-  //   srcPointDistanceGradient.normalize(); // only direction is required
-  double srcPointDistance = src->getDistance(spatialIndex, srcDisplacementField);
-  double destPointDistance = dest->getDistanceAtIndex(spatialIndex);
-  // computeDistanceGradient ֵķĸΪλ(Ϊ˱ĸС)ʵʾ Ҫʵʾ
-  return (srcPointDistance - destPointDistance) / VoxelSize * srcPointDistanceGradient.array();
-}
-
 Eigen::Vector3d KillingFusion::computeKillingEnergyGradient(const DisplacementField *srcDisplacementField,
                                                             const Eigen::Vector3i &spatialIndex)
 {
   Eigen::Vector3d killingGrad = srcDisplacementField->computeKillingEnergyGradient2(spatialIndex);
   return killingGrad;
 }
-
-Eigen::Vector3d KillingFusion::computeLevelSetEnergyGradient(const SDF *src,
-                                                             const SDF *dest,
-                                                             const DisplacementField *srcDisplacementField,
-                                                             const Eigen::Vector3i &spatialIndex)
-{
-  // Compute distance gradient
-  Eigen::Vector3d grad = src->computeDistanceGradient(spatialIndex, srcDisplacementField);
-
-  // Compute Hessian
-  Eigen::Matrix3d hessian = src->computeDistanceHessian(spatialIndex, srcDisplacementField);
-  // ﺣɭ͵ǻصԪ󵼵ģûл㵽ʵλˣ ΪӰ첻
-  Eigen::Vector3d levelSetGrad = hessian * grad * (grad.norm() - 1) / (grad.norm() + epsilon);
-  return levelSetGrad;
-}
-
-// ӳƽͷ׶߽
-std::pair<Eigen::Vector3d, Eigen::Vector3d> KillingFusion::computeBounds(int w, int h, double minDepth, double maxDepth)
-{
-  // Create frustum for the camera
-  Eigen::MatrixXd cornerPoints;
-  cornerPoints.resize(3, 8);
-  cornerPoints << 0, 0, w - 1, w - 1, 0, 0, w - 1, w - 1,
-                  0, h - 1, h - 1, 0, 0, h - 1, h - 1, 0,
-                  1, 1, 1, 1, 1, 1, 1, 1;
-
-  Eigen::Matrix<double, 1, 8> cornersDepth;
-  cornersDepth << minDepth, minDepth, minDepth, minDepth,
-      maxDepth, maxDepth, maxDepth, maxDepth;
-
-  // Compute depthIntrinsicMatrix
-  Eigen::Matrix3d depthIntrinsicMatrix = m_datasetReader.getDepthIntrinsicMatrix();
-  Eigen::Matrix3d depthIntrinsicMatrixInv = depthIntrinsicMatrix.inverse();
-
-  // Compute the corner location in the Camera Coordinate System(CCS)
-  Eigen::MatrixXd imagePoints = depthIntrinsicMatrixInv * cornerPoints;
-
-  // Compute the frustum in the Camera Coordinate System(CCS)
-  imagePoints.conservativeResize(4, 8); // Resize from 3x8 to 4x8
-  imagePoints.topLeftCorner(2, 4) =      // ӱ߽ǿʼȡӾ
-      imagePoints.topLeftCorner(2, 4) * minDepth; // Multiply front four corners with minDepth
-  imagePoints.topRightCorner(2, 4) =
-      imagePoints.topRightCorner(2, 4) * maxDepth; // Multiply back four corners with maxDepth
-  imagePoints.row(3) = imagePoints.row(2);         // Move ones below
-  imagePoints.row(2) = cornersDepth.transpose();   // Replace 3rd row with min/max depth values
-
-  // Compute world location of this frustum
-  // Since world is same as camera, is Eigen::Matrix4d::Identity()
-  Eigen::Matrix4d camera_to_world_pose = Eigen::Matrix4d::Identity();
-  Eigen::Matrix<double, 4, 8> frustumWorldPoints = camera_to_world_pose * imagePoints;
-  // Compute the bounds of parallelogram containing the frustum
-  Eigen::Vector4d minXYZ = frustumWorldPoints.rowwise().minCoeff().array();
-  Eigen::Vector4d maxXYZ = frustumWorldPoints.rowwise().maxCoeff().array();
-
-  Eigen::Vector3d min3dLoc(minXYZ(0), minXYZ(1), minXYZ(2));
-  Eigen::Vector3d max3dLoc(maxXYZ(0), maxXYZ(1), maxXYZ(2));
-
-  return pair<Eigen::Vector3d, Eigen::Vector3d>(min3dLoc, max3dLoc);
-}
@@ -9,8 +9,15 @@
 #include "SimpleMesh.h"
 #include "MarchingCubes.h"
 #include "utils.h"
+#include "FiniteDifferences.h"
+#include "TrilinearSampler.h"
+#include "VolumeOps.h"
 using namespace std;
 
+// Offset of the 8 corners of the grid cell at (x,y,z), in the corner order of Polygonise.
+static const int cornerOffset[8][3] = {{1, 0, 0}, {0, 0, 0}, {0, 1, 0}, {1, 1, 0},
+                                       {1, 0, 1}, {0, 0, 1}, {0, 1, 1}, {1, 1, 1}};
+
 SDF::SDF(double _voxelSize,
          Eigen::Vector3d _min3dLoc,
          Eigen::Vector3d _max3dLoc,
@@ -44,7 +51,10 @@ SDF::SDF(const SDF &copy) noexcept
 
 SDF::SDF(SDF &&other) noexcept
     : m_voxelGridTSDF(std::move(other.m_voxelGridTSDF)),
-      m_voxelGridWeight(std::move(other.m_voxelGridWeight))
+      m_voxelGridWeight(std::move(other.m_voxelGridWeight)),
+      m_numBricks(other.m_numBricks),
+      m_dirtyBricks(std::move(other.m_dirtyBricks)),
+      m_brickMeshes(std::move(other.m_brickMeshes))
 {
     m_voxelSize = other.m_voxelSize;
     m_bound = other.m_bound;
@@ -130,8 +140,12 @@ void SDF::allocateMemoryForSDF()
     m_voxelGridWeight.resize(m_totalNumberOfVoxels);
     // Set the distance to 1, since 1 represents each point is too far from the surface.
     // This is done for any voxel which had no correspondences in the image and thus was never processed.
-    std::fill(m_voxelGridTSDF.begin(), m_voxelGridTSDF.end(), MaxSurfaceVoxelDistance+epsilon);
-    std::fill(m_voxelGridWeight.begin(), m_voxelGridWeight.end(), 0);
+    VolumeOps::fill(m_voxelGridTSDF.data(), m_totalNumberOfVoxels, MaxSurfaceVoxelDistance+epsilon);
+    VolumeOps::fill(m_voxelGridWeight.data(), m_totalNumberOfVoxels, short(0));
+    // All bricks start dirty, so that the first getCachedMesh extracts all of them.
+    m_numBricks = (m_gridSize.array() + MESH_BRICK_SIZE - 1) / MESH_BRICK_SIZE;
+    m_dirtyBricks.assign(m_numBricks.prod(), 1);
+    m_brickMeshes.assign(m_numBricks.prod(), MeshSlice());
 }
 
 void SDF::integrateDepthFrame(cv::Mat depthFrame,
@@ -193,7 +207,38 @@ void SDF::integrateDepthFrame(cv::Mat depthFrame,
                     (m_voxelGridTSDF.at(index) * m_voxelGridWeight.at(index) + dist) /
                     (m_voxelGridWeight.at(index) + 1);
 				// ͳһµȨΪ1
-                m_voxelGridWeight.at(index) += 1;
+                m_voxelGridWeight.at(index) = min(m_voxelGridWeight.at(index) + 1, MAX_FUSION_WEIGHT);
+                markDirtyBrick(x, y, z);
+            }
+        }
+    }
+}
+
+void SDF::fuseVoxel(int voxelIndex, double dist2, long w2)
+{
+    long w1 = m_voxelGridWeight[voxelIndex];
+    if (w1 == 0)
+    {
+        m_voxelGridTSDF[voxelIndex] = dist2;
+        m_voxelGridWeight[voxelIndex] = min(w2, long(MAX_FUSION_WEIGHT));
+    }
+    else
+    {
+        double dist1 = m_voxelGridTSDF[voxelIndex];
+        if (FUSE_BY_MERGE)
+        { // If voxels are aligned, this addition makes sense
+            // A stable voxel would barely move, thus skip the division and both writes.
+            if (w1 >= MAX_FUSION_WEIGHT && fabs(dist1 - dist2) <= saturatedFuseTolerance)
+                return;
+            m_voxelGridTSDF[voxelIndex] = (w1 * dist1 + w2 * dist2) / (w1 + w2);
+            m_voxelGridWeight[voxelIndex] = min(w1 + w2, long(MAX_FUSION_WEIGHT));
+        }
+        else
+        { // If you think of SDF mathematically, this is how you should fuse.
+            if (fabs(dist1) >= fabs(dist2))
+            {
+                m_voxelGridTSDF[voxelIndex] = dist2;
+                m_voxelGridWeight[voxelIndex] = min(w2, long(MAX_FUSION_WEIGHT));
             }
         }
     }
@@ -201,6 +246,14 @@ void SDF::integrateDepthFrame(cv::Mat depthFrame,
 
 void SDF::fuse(const SDF *otherSdf)
 {
+    if (FUSE_BY_MERGE)
+    {
+        VolumeOps::mergeWeighted(m_voxelGridTSDF.data(), m_voxelGridWeight.data(),
+                                 otherSdf->m_voxelGridTSDF.data(), otherSdf->m_voxelGridWeight.data(),
+                                 m_totalNumberOfVoxels, MAX_FUSION_WEIGHT, saturatedFuseTolerance);
+        markChangedBricks(otherSdf->m_voxelGridWeight);
+        return;
+    }
 #ifndef MY_DEBUG
 #pragma omp parallel for
 #endif
@@ -210,44 +263,16 @@ void SDF::fuse(const SDF *otherSdf)
         // Ignore voxels that are at distance -1 behind the surface in otherSDF. No change needed.
         if (w2 == 0)
             continue;
-
-        long w1 = m_voxelGridWeight.at(voxelIndex);
-        double dist2 = otherSdf->m_voxelGridTSDF.at(voxelIndex);
-        if (w1 == 0)
-        {
-            m_voxelGridTSDF.at(voxelIndex) = dist2;
-            m_voxelGridWeight.at(voxelIndex) = w2;
-        }
-        else
-        {
-            double dist1 = m_voxelGridTSDF.at(voxelIndex);
-            if (FUSE_BY_MERGE)
-            { // If voxels are aligned, this addition makes sense
-                m_voxelGridTSDF.at(voxelIndex) = (w1 * dist1 + w2 * dist2) / (w1 + w2);
-                m_voxelGridWeight.at(voxelIndex) = (w1 + w2);
-            }
-            else
-            { // If you think of SDF mathematically, this is how you should fuse.
-                if (fabs(dist1) < fabs(dist2))
-                {
-                    m_voxelGridTSDF.at(voxelIndex) = dist1;
-                    m_voxelGridWeight.at(voxelIndex) = w1;
-                }
-                else
-                {
-                    m_voxelGridTSDF.at(voxelIndex) = dist2;
-                    m_voxelGridWeight.at(voxelIndex) = w2;
-                }
-            }
-        }
+        fuseVoxel(voxelIndex, otherSdf->m_voxelGridTSDF.at(voxelIndex), w2);
     }
+    markChangedBricks(otherSdf->m_voxelGridWeight);
 }
 
-// Ignore this, not used in processNextFrame method.
+// Same result as otherSdf->update(otherDisplacementField) followed by fuse(otherSdf), without writing the warped SDF.
 void SDF::fuse(const SDF *otherSdf, const DisplacementField *otherDisplacementField)
 {
 #ifndef MY_DEBUG
-#pragma omp parallel for
+#pragma omp parallel for schedule(dynamic)
 #endif
     for (int z = 0; z < m_gridSize(2); z++)
     {
@@ -257,53 +282,51 @@ void SDF::fuse(const SDF *otherSdf, const DisplacementField *otherDisplacementFi
             {
                 Eigen::Vector3d otherSdfIndex = Eigen::Vector3d(x + 0.5, y + 0.5, z + 0.5) +
                                                 otherDisplacementField->getDisplacementAt(x, y, z);
-                // Tricky Part: We need to first get weight at otherSdfIndex.
-                double w2 = otherSdf->getWeight(otherSdfIndex);
+                // Tricky Part: We need to first get weight at otherSdfIndex. It is truncated as update stores it.
+                long w2 = long(otherSdf->getWeight(otherSdfIndex));
                 // Ignore voxels that are at distance -1 behind the surface in otherSDF. No change needed.
-                // http://realtimecollisiondetection.net/blog/?p=89
-                if (fabs(w2) < 1e-5f) // Nearly Zero
-                    continue;         // Make no change to this voxel.
-
-                long w1 = getWeightAtIndex(x, y, z);
-                double dist2 = otherSdf->getDistance(otherSdfIndex);
-                int voxelIndex = z * m_gridSpacingPerAxis(2) + y * m_gridSpacingPerAxis(1) + x;
-                if (w1 == 0)
-                {
-                    m_voxelGridTSDF.at(voxelIndex) = dist2;
-                    m_voxelGridWeight.at(voxelIndex) = w2;
-                }
-                else
-                {
-                    double dist1 = m_voxelGridTSDF.at(voxelIndex);
-                    if (FUSE_BY_MERGE)
-                    { // If voxels are aligned, this addition makes sense
-                        m_voxelGridTSDF.at(voxelIndex) = (w1 * dist1 + w2 * dist2) / (w1 + w2);
-                        m_voxelGridWeight.at(voxelIndex) = (w1 + w2);
-                    }
-                    else
-                    { // If you think of SDF mathematically, this is how you should fuse.
-                        if (fabs(dist1) < fabs(dist2))
-                        {
-                            m_voxelGridTSDF.at(voxelIndex) = dist1;
-                            m_voxelGridWeight.at(voxelIndex) = w1;
-                        }
-                        else
-                        {
-                            m_voxelGridTSDF.at(voxelIndex) = dist2;
-                            m_voxelGridWeight.at(voxelIndex) = w2;
-                        }
-                    }
-                }
+                if (w2 == 0)
+                    continue; // Make no change to this voxel.
+                fuseVoxel(z * m_gridSpacingPerAxis(2) + y * m_gridSpacingPerAxis(1) + x,
+                          otherSdf->getDistance(otherSdfIndex), w2);
+                markDirtyBrick(x, y, z);
             }
         }
     }
 }
 
+void SDF::testFuseSaturation()
+{
+    SDF canonicalSdf(0.5, Eigen::Vector3d(0, 0, 0), Eigen::Vector3d(1, 1, 1), UnknownClipDistance);
+    SDF liveSdf(canonicalSdf);
+    canonicalSdf.m_voxelGridTSDF[0] = 0.5 * VoxelSize;
+    canonicalSdf.m_voxelGridWeight[0] = MAX_FUSION_WEIGHT - 1;
+    liveSdf.m_voxelGridTSDF[0] = 0.5 * VoxelSize;
+    liveSdf.m_voxelGridWeight[0] = 4;
+
+    // Weight saturates instead of overflowing short.
+    canonicalSdf.fuse(&liveSdf);
+    assert(canonicalSdf.m_voxelGridWeight[0] == MAX_FUSION_WEIGHT && "Whoops, check SDF::fuseVoxel saturation");
+    assert(fabs(canonicalSdf.m_voxelGridTSDF[0] - 0.5 * VoxelSize) < epsilon && "Whoops, check SDF::fuseVoxel");
+
+    // Saturated voxel which agrees with the live distance is left as is.
+    liveSdf.m_voxelGridTSDF[0] = 0.5 * VoxelSize + saturatedFuseTolerance / 2;
+    canonicalSdf.fuse(&liveSdf);
+    assert(canonicalSdf.m_voxelGridTSDF[0] == 0.5 * VoxelSize && "Whoops, check SDF::fuseVoxel skip");
+
+    // Saturated voxel still follows a live distance which disagrees, as a running average.
+    liveSdf.m_voxelGridTSDF[0] = -0.5 * VoxelSize;
+    canonicalSdf.fuse(&liveSdf);
+    double expected = (MAX_FUSION_WEIGHT * 0.5 * VoxelSize - 4 * 0.5 * VoxelSize) / (MAX_FUSION_WEIGHT + 4);
+    assert(fabs(canonicalSdf.m_voxelGridTSDF[0] - expected) < epsilon && "Whoops, check SDF::fuseVoxel running average");
+    assert(canonicalSdf.m_voxelGridWeight[0] == MAX_FUSION_WEIGHT && "Whoops, check SDF::fuseVoxel saturation");
+}
+
 // Tested by using displacementField of deltaX, 0, 0
 void SDF::update(const DisplacementField *displacementField)
 {
     std::vector<double> newVoxelGridTSDF;
-    std::vector<long> newVoxelGridWeight;
+    std::vector<short> newVoxelGridWeight;
     newVoxelGridTSDF.resize(m_totalNumberOfVoxels);
     newVoxelGridWeight.resize(m_totalNumberOfVoxels);
     std::fill(newVoxelGridTSDF.begin(), newVoxelGridTSDF.end(), 1.0f);
@@ -328,56 +351,176 @@ void SDF::update(const DisplacementField *displacementField)
     // Swap the current SDF and weights with the new computed SDF and weights
     m_voxelGridTSDF.swap(newVoxelGridTSDF);
     m_voxelGridWeight.swap(newVoxelGridWeight);
+    fill(m_dirtyBricks.begin(), m_dirtyBricks.end(), 1);
 }
 
-bool SDF::ProcessVolumeCell(int x, int y, int z, double iso, SimpleMesh *mesh) const
+// Narrowing the double comparisons to bytes pays off only from AVX2, thus an AVX2 clone is picked at load time where
+// the CPU has it. Build with -DDISABLE_SIMD to always use the baseline.
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__) && !defined(DISABLE_SIMD)
+#define CLASSIFY_TARGET_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define CLASSIFY_TARGET_CLONES
+#endif
+
+// Marching cubes index of each cell of a row, from node rows y and y+1 of plane z (lower) and plane z+1 (upper).
+CLASSIFY_TARGET_CLONES static void classifyCellRow(const double *lower0,
+                            const double *lower1,
+                            const double *upper0,
+                            const double *upper1,
+                            double iso,
+                            int numCells,
+                            unsigned char *cubeIndex)
 {
-    MC_Gridcell cell;
+#ifndef DISABLE_OPENMP
+#pragma omp simd
+#endif
+    for (int x = 0; x < numCells; x++)
+        cubeIndex[x] = (lower0[x + 1] < iso) | (lower0[x] < iso) << 1 | (lower1[x] < iso) << 2 | (lower1[x + 1] < iso) << 3 |
+                       (upper0[x + 1] < iso) << 4 | (upper0[x] < iso) << 5 | (upper1[x] < iso) << 6 | (upper1[x + 1] < iso) << 7;
+}
 
-    Eigen::Vector3d tmp;
+void SDF::loadDistancePlane(int z, const Eigen::Vector3i &cellBegin, const Eigen::Vector3i &cellEnd, double *plane) const
+{
+    int planeWidth = cellEnd(0) - cellBegin(0) + 1;
+    int numNodesInGrid = min(cellEnd(0) + 1, m_gridSize(0)) - cellBegin(0);
+    double outsideDistance = MaxSurfaceVoxelDistance + epsilon;
+    for (int y = cellBegin(1); y <= cellEnd(1); y++)
+    {
+        double *row = plane + (y - cellBegin(1)) * planeWidth;
+        if (z < m_gridSize(2) && y < m_gridSize(1))
+        {
+            copy_n(m_voxelGridTSDF.begin() + z * m_gridSpacingPerAxis(2) + y * m_gridSpacingPerAxis(1) + cellBegin(0),
+                   numNodesInGrid, row);
+            fill_n(row + numNodesInGrid, planeWidth - numNodesInGrid, outsideDistance);
+        }
+        else
+            fill_n(row, planeWidth, outsideDistance);
+    }
+}
 
-    // cell corners
-    Eigen::Vector3d halfGridSize = (m_gridSize.cast<double>() / 2);
-    cell.p[0] = (Eigen::Vector3d(x + 1, y, z).array() / halfGridSize.array()) - 1;
-    cell.p[1] = (Eigen::Vector3d(x, y, z).array() / halfGridSize.array()) - 1;
-    cell.p[2] = (Eigen::Vector3d(x, y + 1, z).array() / halfGridSize.array()) - 1;
-    cell.p[3] = (Eigen::Vector3d(x + 1, y + 1, z).array() / halfGridSize.array()) - 1;
-    cell.p[4] = (Eigen::Vector3d(x + 1, y, z + 1).array() / halfGridSize.array()) - 1;
-    cell.p[5] = (Eigen::Vector3d(x, y, z + 1).array() / halfGridSize.array()) - 1;
-    cell.p[6] = (Eigen::Vector3d(x, y + 1, z + 1).array() / halfGridSize.array()) - 1;
-    cell.p[7] = (Eigen::Vector3d(x + 1, y + 1, z + 1).array() / halfGridSize.array()) - 1;
+template <typename CellVisitor>
+void SDF::forEachSurfaceCell(const Eigen::Vector3i &cellBegin, const Eigen::Vector3i &cellEnd, double iso, CellVisitor visitCell) const
+{
+    // Sliding window of the two node planes of a slice of cells. Each voxel is read once per plane it is in.
+    int numCells = cellEnd(0) - cellBegin(0);
+    int planeWidth = numCells + 1;
+    std::vector<double> lowerPlane(planeWidth * (cellEnd(1) - cellBegin(1) + 1)), upperPlane(lowerPlane.size());
+    std::vector<unsigned char> cubeIndex(numCells);
+    loadDistancePlane(cellBegin(2), cellBegin, cellEnd, upperPlane.data());
+    for (int z = cellBegin(2); z < cellEnd(2); z++)
+    {
+        lowerPlane.swap(upperPlane);
+        loadDistancePlane(z + 1, cellBegin, cellEnd, upperPlane.data());
+        for (int y = cellBegin(1); y < cellEnd(1); y++)
+        {
+            const double *lowerRow = &lowerPlane[(y - cellBegin(1)) * planeWidth];
+            const double *upperRow = &upperPlane[(y - cellBegin(1)) * planeWidth];
+            classifyCellRow(lowerRow, lowerRow + planeWidth, upperRow, upperRow + planeWidth, iso, numCells,
+                            cubeIndex.data());
+            for (int i = 0; i < numCells; i++)
+            {
+                // Cube is entirely in/out of the surface
+                if (cubeIndex[i] == 0 || cubeIndex[i] == 255)
+                    continue;
+                double distance = lowerRow[i];
+                // if (distance > MaxSurfaceVoxelDistance || distance < -MaxSurfaceVoxelDistance)
+                if (distance > MaxSurfaceVoxelDistance || distance < -UnknownClipDistance)
+                    continue;
+                double val[8];
+                for (int c = 0; c < 8; c++)
+                {
+                    const double *plane = cornerOffset[c][2] ? upperRow : lowerRow;
+                    val[c] = plane[cornerOffset[c][1] * planeWidth + i + cornerOffset[c][0]];
+                }
+                visitCell(cellBegin(0) + i, y, z, cubeIndex[i], val);
+            }
+        }
+    }
+}
 
-    // cell corner values
-    cell.val[0] = (double)getDistanceAtIndex(x + 1, y, z);
-    cell.val[1] = (double)getDistanceAtIndex(x, y, z);
-    cell.val[2] = (double)getDistanceAtIndex(x, y + 1, z);
-    cell.val[3] = (double)getDistanceAtIndex(x + 1, y + 1, z);
-    cell.val[4] = (double)getDistanceAtIndex(x + 1, y, z + 1);
-    cell.val[5] = (double)getDistanceAtIndex(x, y, z + 1);
-    cell.val[6] = (double)getDistanceAtIndex(x, y + 1, z + 1);
-    cell.val[7] = (double)getDistanceAtIndex(x + 1, y + 1, z + 1);
+void SDF::extractCells(const Eigen::Vector3i &cellBegin, const Eigen::Vector3i &cellEnd, MeshSlice *slice) const
+{
+    double iso = 0;
+    forEachSurfaceCell(cellBegin, cellEnd, iso, [&](int x, int y, int z, int cubeIndex, const double *val) {
+        ProcessVolumeCell(x, y, z, cubeIndex, val, iso, slice);
+    });
+}
 
-    MC_Triangle tris[6];
-    int numTris = Polygonise(cell, iso, tris);
+void SDF::appendMeshSlice(const MeshSlice &slice,
+                          const Eigen::Vector3i &cellBegin,
+                          const Eigen::Vector3i &cellEnd,
+                          std::unordered_map<long long, unsigned int> &sharedVertices,
+                          SimpleMesh *mesh) const
+{
+    std::vector<unsigned int> meshVertex(slice.vertices.size());
+    for (size_t i = 0; i < slice.vertices.size(); i++)
+    {
+        // Decode lower node and axis of the edge, see ProcessVolumeCell.
+        long long edgeKey = slice.vertexEdges[i];
+        int axis = edgeKey % 3;
+        long long nodeIndex = edgeKey / 3;
+        Eigen::Vector3i node(nodeIndex % (m_gridSize(0) + 1),
+                             nodeIndex / (m_gridSize(0) + 1) % (m_gridSize(1) + 1),
+                             nodeIndex / (m_gridSize(0) + 1) / (m_gridSize(1) + 1));
+        // Cells around the edge are on both sides of it along the other two axes, thus some are outside of the slice
+        // when the edge is on its boundary.
+        bool shared = false;
+        for (int j = 0; j < 3; j++)
+            shared |= j != axis && (node(j) == cellBegin(j) || node(j) == cellEnd(j));
+        if (shared)
+        {
+            auto sharedVertex = sharedVertices.find(edgeKey);
+            if (sharedVertex != sharedVertices.end())
+            {
+                meshVertex[i] = sharedVertex->second;
+                continue;
+            }
+        }
+        Vertex vertex = slice.vertices[i];
+        meshVertex[i] = mesh->AddVertex(vertex);
+        if (shared)
+            sharedVertices[edgeKey] = meshVertex[i];
+    }
+    for (const Triangle &triangle : slice.triangles)
+        mesh->AddFace(meshVertex[triangle.idx0], meshVertex[triangle.idx1], meshVertex[triangle.idx2]);
+}
 
-    if (numTris == 0)
-        return false;
+void SDF::ProcessVolumeCell(int x, int y, int z, int cubeIndex, const double *val, double iso, MeshSlice *slice) const
+{
+    int triangleEdges[15];
+    int numTris = PolygoniseEdges(cubeIndex, triangleEdges);
 
-    for (int i1 = 0; i1 < numTris; i1++)
+    Eigen::Vector3d halfGridSize = (m_gridSize.cast<double>() / 2);
+    unsigned int vhandle[15];
+    for (int i = 0; i < 3 * numTris; i++)
     {
-        Vertex v0((double)tris[i1].p[0][0], (double)tris[i1].p[0][1], (double)tris[i1].p[0][2]);
-        Vertex v1((double)tris[i1].p[1][0], (double)tris[i1].p[1][1], (double)tris[i1].p[1][2]);
-        Vertex v2((double)tris[i1].p[2][0], (double)tris[i1].p[2][1], (double)tris[i1].p[2][2]);
-
-        unsigned int vhandle[3];
-        vhandle[0] = mesh->AddVertex(v0);
-        vhandle[1] = mesh->AddVertex(v1);
-        vhandle[2] = mesh->AddVertex(v2);
+        // Order edge from lower to upper grid node, so that all cells around it compute the same vertex.
+        int c0 = edgeCorners[triangleEdges[i]][0], c1 = edgeCorners[triangleEdges[i]][1];
+        Eigen::Vector3i node0(x + cornerOffset[c0][0], y + cornerOffset[c0][1], z + cornerOffset[c0][2]);
+        Eigen::Vector3i node1(x + cornerOffset[c1][0], y + cornerOffset[c1][1], z + cornerOffset[c1][2]);
+        if (node0.sum() > node1.sum())
+        {
+            swap(c0, c1);
+            swap(node0, node1);
+        }
+        int axis = node1(0) != node0(0) ? 0 : (node1(1) != node0(1) ? 1 : 2);
+        long long edgeKey = (((long long)node0(2) * (m_gridSize(1) + 1) + node0(1)) * (m_gridSize(0) + 1) + node0(0)) * 3 + axis;
 
-        mesh->AddFace(vhandle[0], vhandle[1], vhandle[2]);
+        auto sharedVertex = slice->edgeToVertex.find(edgeKey);
+        if (sharedVertex != slice->edgeToVertex.end())
+        {
+            vhandle[i] = sharedVertex->second;
+            continue;
+        }
+        Eigen::Vector3d p0 = (node0.cast<double>().array() / halfGridSize.array()) - 1;
+        Eigen::Vector3d p1 = (node1.cast<double>().array() / halfGridSize.array()) - 1;
+        vhandle[i] = (unsigned int)slice->vertices.size();
+        slice->vertices.push_back(VertexInterp(iso, p0, p1, val[c0], val[c1]));
+        slice->vertexEdges.push_back(edgeKey);
+        slice->edgeToVertex[edgeKey] = vhandle[i];
     }
-
-    return true;
+    for (int i = 0; i < numTris; i++)
+        slice->triangles.push_back(Triangle(vhandle[3 * i], vhandle[3 * i + 1], vhandle[3 * i + 2]));
 }
 
 void SDF::save_mesh(std::string mesh_name_prefix,
@@ -398,38 +541,368 @@ void SDF::save_mesh(std::string mesh_name_prefix,
 
 SimpleMesh *SDF::getMesh() const
 {
+    // Slabs of slices of cells are polygonised in parallel and appended in order, thus the mesh is the same for any
+    // number of threads. A few slices per slab let the sliding window of extractCells reuse most planes.
+    const int slabSize = 4;
+    int numSlabs = (m_gridSize(2) + slabSize - 1) / slabSize;
+    std::vector<MeshSlice> slabMeshes(numSlabs);
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int slab = 0; slab < numSlabs; slab++)
+    {
+        extractCells(Eigen::Vector3i(0, 0, slab * slabSize),
+                     Eigen::Vector3i(m_gridSize(0), m_gridSize(1), min((slab + 1) * slabSize, m_gridSize(2))),
+                     &slabMeshes[slab]);
+    }
     SimpleMesh *mesh = new SimpleMesh();
-    for (int z = 0; z < m_gridSize(2); z++)
+    std::unordered_map<long long, unsigned int> sharedVertices;
+    for (int slab = 0; slab < numSlabs; slab++)
     {
-        for (int y = 0; y < m_gridSize(1); y++)
+        appendMeshSlice(slabMeshes[slab], Eigen::Vector3i(0, 0, slab * slabSize),
+                        Eigen::Vector3i(m_gridSize(0), m_gridSize(1), min((slab + 1) * slabSize, m_gridSize(2))),
+                        sharedVertices, mesh);
+    }
+    return mesh;
+}
+
+void SDF::getBrickCells(int brickIndex, Eigen::Vector3i &cellBegin, Eigen::Vector3i &cellEnd) const
+{
+    Eigen::Vector3i brick(brickIndex % m_numBricks(0),
+                          brickIndex / m_numBricks(0) % m_numBricks(1),
+                          brickIndex / m_numBricks(0) / m_numBricks(1));
+    cellBegin = brick * MESH_BRICK_SIZE;
+    cellEnd = (cellBegin.array() + MESH_BRICK_SIZE).min(m_gridSize.array());
+}
+
+void SDF::markDirtyBrick(int x, int y, int z)
+{
+    int brickIndex = ((z / MESH_BRICK_SIZE) * m_numBricks(1) + y / MESH_BRICK_SIZE) * m_numBricks(0) + x / MESH_BRICK_SIZE;
+#ifndef DISABLE_OPENMP
+#pragma omp atomic write
+#endif
+    m_dirtyBricks[brickIndex] = 1;
+}
+
+void SDF::markChangedBricks(const std::vector<short> &otherWeight)
+{
+    int numBricks = m_numBricks.prod();
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int brickIndex = 0; brickIndex < numBricks; brickIndex++)
+    {
+        if (m_dirtyBricks[brickIndex])
+            continue;
+        Eigen::Vector3i cellBegin, cellEnd;
+        getBrickCells(brickIndex, cellBegin, cellEnd);
+        bool changed = false;
+        for (int z = cellBegin(2); z < cellEnd(2) && !changed; z++)
+            for (int y = cellBegin(1); y < cellEnd(1) && !changed; y++)
+                for (int x = cellBegin(0); x < cellEnd(0) && !changed; x++)
+                    changed = otherWeight[z * m_gridSpacingPerAxis(2) + y * m_gridSpacingPerAxis(1) + x] != 0;
+        m_dirtyBricks[brickIndex] = changed;
+    }
+}
+
+SimpleMesh *SDF::getCachedMesh()
+{
+    // Cells of a brick read nodes up to the first ones of the next bricks, thus a brick is stale when it or one of
+    // the bricks after it along x, y and z changed.
+    std::vector<int> staleBricks;
+    for (int bz = 0; bz < m_numBricks(2); bz++)
+        for (int by = 0; by < m_numBricks(1); by++)
+            for (int bx = 0; bx < m_numBricks(0); bx++)
+            {
+                bool stale = false;
+                for (int neighbour = 0; neighbour < 8; neighbour++)
+                {
+                    Eigen::Vector3i brick(bx + (neighbour & 1), by + (neighbour >> 1 & 1), bz + (neighbour >> 2 & 1));
+                    if ((brick.array() < m_numBricks.array()).all())
+                        stale |= m_dirtyBricks[(brick(2) * m_numBricks(1) + brick(1)) * m_numBricks(0) + brick(0)] != 0;
+                }
+                if (stale)
+                    staleBricks.push_back((bz * m_numBricks(1) + by) * m_numBricks(0) + bx);
+            }
+
+    int numStaleBricks = staleBricks.size();
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int i = 0; i < numStaleBricks; i++)
+    {
+        MeshSlice &brickMesh = m_brickMeshes[staleBricks[i]];
+        brickMesh = MeshSlice();
+        Eigen::Vector3i cellBegin, cellEnd;
+        getBrickCells(staleBricks[i], cellBegin, cellEnd);
+        extractCells(cellBegin, cellEnd, &brickMesh);
+        // Edge lookup is only needed while extracting.
+        std::unordered_map<long long, unsigned int>().swap(brickMesh.edgeToVertex);
+    }
+    fill(m_dirtyBricks.begin(), m_dirtyBricks.end(), 0);
+
+    SimpleMesh *mesh = new SimpleMesh();
+    std::unordered_map<long long, unsigned int> sharedVertices;
+    for (int brickIndex = 0; brickIndex < m_numBricks.prod(); brickIndex++)
+    {
+        Eigen::Vector3i cellBegin, cellEnd;
+        getBrickCells(brickIndex, cellBegin, cellEnd);
+        appendMeshSlice(m_brickMeshes[brickIndex], cellBegin, cellEnd, sharedVertices, mesh);
+    }
+    return mesh;
+}
+
+void SDF::testGetCachedMesh()
+{
+    // Sphere over several bricks, of which the live SDF only sees one corner.
+    double voxelSize = 0.5;
+    SDF canonicalSdf(voxelSize, Eigen::Vector3d(0, 0, 0), Eigen::Vector3d(20, 20, 20), UnknownClipDistance);
+    SDF liveSdf(canonicalSdf);
+    Eigen::Vector3d center = canonicalSdf.m_gridSize.cast<double>() / 2;
+    for (int z = 0; z < canonicalSdf.m_gridSize(2); z++)
+    {
+        for (int y = 0; y < canonicalSdf.m_gridSize(1); y++)
         {
-            for (int x = 0; x < m_gridSize(0); x++)
+            for (int x = 0; x < canonicalSdf.m_gridSize(0); x++)
             {
-                double distance = getDistanceAtIndex(x, y, z);
-                // if (distance > MaxSurfaceVoxelDistance || distance < -MaxSurfaceVoxelDistance)
-                if (distance > MaxSurfaceVoxelDistance || distance < -UnknownClipDistance)
+                Eigen::Vector3d voxelLocation(x + 0.5, y + 0.5, z + 0.5);
+                int voxelIndex = z * canonicalSdf.m_gridSpacingPerAxis(2) + y * canonicalSdf.m_gridSpacingPerAxis(1) + x;
+                double distance = ((voxelLocation - center).norm() - 12) * VoxelSize;
+                canonicalSdf.m_voxelGridTSDF[voxelIndex] = distance;
+                canonicalSdf.m_voxelGridWeight[voxelIndex] = 1;
+                liveSdf.m_voxelGridTSDF[voxelIndex] = distance + VoxelSize / 2;
+                liveSdf.m_voxelGridWeight[voxelIndex] = x < 16 && y < 16 && z < 12;
+            }
+        }
+    }
+
+    // First call extracts all bricks, the next ones only the bricks the live SDF changed and those before them.
+    for (int i = 0; i < 3; i++)
+    {
+        if (i > 0)
+            canonicalSdf.fuse(&liveSdf);
+        SimpleMesh *cachedMesh = canonicalSdf.getCachedMesh();
+        SimpleMesh *mesh = canonicalSdf.getMesh();
+        assert(cachedMesh->GetVertices().size() == mesh->GetVertices().size() &&
+               cachedMesh->GetTriangles().size() == mesh->GetTriangles().size() && "Whoops, check SDF::getCachedMesh");
+        Eigen::Vector3d cachedSum(0, 0, 0), sum(0, 0, 0);
+        for (size_t v = 0; v < mesh->GetVertices().size(); v++)
+        {
+            cachedSum += cachedMesh->GetVertices()[v];
+            sum += mesh->GetVertices()[v];
+        }
+        assert((cachedSum - sum).norm() < 1e-3 && "Whoops, check SDF::getCachedMesh");
+        delete cachedMesh;
+        delete mesh;
+    }
+}
+
+SimpleMesh *SDF::getSurfaceNetsMesh() const
+{
+    // Naive surface nets over the cells of getMesh - one vertex per surface cell, at the mean of the crossings on its
+    // edges, and one quad between the 4 cells around each crossed grid edge.
+    const double iso = 0;
+    const int slabSize = 4;
+    int numSlabs = (m_gridSize(2) + slabSize - 1) / slabSize;
+    Eigen::Vector3d halfGridSize = (m_gridSize.cast<double>() / 2);
+    std::vector<std::vector<int>> slabCells(numSlabs);
+    std::vector<std::vector<unsigned char>> slabCubeIndex(numSlabs);
+    std::vector<std::vector<Vertex>> slabVertices(numSlabs);
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int slab = 0; slab < numSlabs; slab++)
+    {
+        forEachSurfaceCell(Eigen::Vector3i(0, 0, slab * slabSize),
+                           Eigen::Vector3i(m_gridSize(0), m_gridSize(1), min((slab + 1) * slabSize, m_gridSize(2))), iso,
+                           [&](int x, int y, int z, int cubeIndex, const double *val) {
+                               Eigen::Vector3d crossingSum(0, 0, 0);
+                               int numCrossings = 0;
+                               for (int e = 0; e < 12; e++)
+                               {
+                                   int c0 = edgeCorners[e][0], c1 = edgeCorners[e][1];
+                                   if ((cubeIndex >> c0 & 1) == (cubeIndex >> c1 & 1))
+                                       continue;
+                                   Eigen::Vector3d p0(cornerOffset[c0][0], cornerOffset[c0][1], cornerOffset[c0][2]);
+                                   Eigen::Vector3d p1(cornerOffset[c1][0], cornerOffset[c1][1], cornerOffset[c1][2]);
+                                   crossingSum += p0 + (iso - val[c0]) / (val[c1] - val[c0]) * (p1 - p0);
+                                   numCrossings++;
+                               }
+                               Eigen::Vector3d node = Eigen::Vector3d(x, y, z) + crossingSum / numCrossings;
+                               slabCells[slab].push_back(z * m_gridSpacingPerAxis(2) + y * m_gridSpacingPerAxis(1) + x);
+                               slabCubeIndex[slab].push_back(cubeIndex);
+                               slabVertices[slab].push_back((node.array() / halfGridSize.array()) - 1);
+                           });
+    }
+
+    SimpleMesh *mesh = new SimpleMesh();
+    std::vector<int> cellVertex(m_totalNumberOfVoxels, -1);
+    for (int slab = 0; slab < numSlabs; slab++)
+        for (size_t i = 0; i < slabVertices[slab].size(); i++)
+            cellVertex[slabCells[slab][i]] = mesh->AddVertex(slabVertices[slab][i]);
+
+    // Crossed edge from node to node + 1 along axis joins the 4 cells at node - {0, 1} along the other two axes. The
+    // cell at node is one of them, thus only the 3 edges from the lower corner of each surface cell are visited. Their
+    // signs are bits of the marching cubes index of the cell.
+    const int axisCorner[3] = {0, 2, 5};
+    std::vector<std::vector<Triangle>> slabTriangles(numSlabs);
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int slab = 0; slab < numSlabs; slab++)
+    {
+        for (size_t i = 0; i < slabCells[slab].size(); i++)
+        {
+            int cellIndex = slabCells[slab][i];
+            Eigen::Vector3i node(cellIndex % m_gridSize(0), cellIndex / m_gridSize(0) % m_gridSize(1),
+                                 cellIndex / m_gridSize(0) / m_gridSize(1));
+            bool inside = slabCubeIndex[slab][i] >> 1 & 1;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                int u = (axis + 1) % 3, v = (axis + 2) % 3;
+                if (node(u) == 0 || node(v) == 0 || bool(slabCubeIndex[slab][i] >> axisCorner[axis] & 1) == inside)
+                    continue;
+                // Counter clockwise around axis.
+                int quad[4] = {cellVertex[cellIndex - m_gridSpacingPerAxis(u) - m_gridSpacingPerAxis(v)],
+                               cellVertex[cellIndex - m_gridSpacingPerAxis(v)],
+                               cellVertex[cellIndex],
+                               cellVertex[cellIndex - m_gridSpacingPerAxis(u)]};
+                if (quad[0] < 0 || quad[1] < 0 || quad[3] < 0)
                     continue;
-                ProcessVolumeCell(x, y, z, 0.00f, mesh);
+                // Same orientation as marching cubes.
+                if (!inside)
+                    swap(quad[1], quad[3]);
+                slabTriangles[slab].push_back(Triangle(quad[0], quad[1], quad[2]));
+                slabTriangles[slab].push_back(Triangle(quad[0], quad[2], quad[3]));
             }
         }
     }
+    for (int slab = 0; slab < numSlabs; slab++)
+        for (const Triangle &triangle : slabTriangles[slab])
+            mesh->AddFace(triangle.idx0, triangle.idx1, triangle.idx2);
+    return mesh;
+}
+
+SimpleMesh *SDF::getSurfaceNetsMesh(const DisplacementField &displacementField) const
+{
+    SimpleMesh *mesh = getSurfaceNetsMesh();
+    warpMesh(displacementField, mesh);
     return mesh;
 }
 
+void SDF::testGetSurfaceNetsMesh()
+{
+    // Surface nets of a sphere is closed - Euler characteristic is 2 - with its vertices close to the sphere.
+    double voxelSize = 0.5;
+    SDF sdf(voxelSize, Eigen::Vector3d(0, 0, 0), Eigen::Vector3d(10, 10, 10), UnknownClipDistance);
+    Eigen::Vector3d center = sdf.m_gridSize.cast<double>() / 2;
+    double radius = 5.3;
+    for (int z = 0; z < sdf.m_gridSize(2); z++)
+        for (int y = 0; y < sdf.m_gridSize(1); y++)
+            for (int x = 0; x < sdf.m_gridSize(0); x++)
+            {
+                int voxelIndex = z * sdf.m_gridSpacingPerAxis(2) + y * sdf.m_gridSpacingPerAxis(1) + x;
+                sdf.m_voxelGridTSDF[voxelIndex] = ((Eigen::Vector3d(x + 0.5, y + 0.5, z + 0.5) - center).norm() - radius) * VoxelSize;
+                sdf.m_voxelGridWeight[voxelIndex] = 1;
+            }
+
+    SimpleMesh *mesh = sdf.getSurfaceNetsMesh();
+    size_t numVertices = mesh->GetVertices().size(), numTriangles = mesh->GetTriangles().size();
+    assert(numTriangles % 2 == 0 && long(numVertices) - long(numTriangles) / 2 == 2 && "Whoops, check SDF::getSurfaceNetsMesh");
+    Eigen::Vector3d halfGridSize = (sdf.m_gridSize.cast<double>() / 2);
+    for (const Vertex &vertex : mesh->GetVertices())
+    {
+        // Node of a voxel is at its center, see ProcessVolumeCell.
+        Eigen::Vector3d gridLocation = (Eigen::Vector3d(vertex(0), -vertex(1), vertex(2)).array() + 1) * halfGridSize.array() + 0.5;
+        assert(fabs((gridLocation - center).norm() - radius) < 0.25 && "Whoops, check SDF::getSurfaceNetsMesh");
+    }
+    delete mesh;
+}
+
 SimpleMesh *SDF::getMesh(const DisplacementField &displacementField) const
 {
-    SDF deformedSdf(m_voxelSize, m_min3dLoc, m_max3dLoc, m_unknownClipDistance);
-    deformedSdf.fuse(this, &displacementField);
-    return deformedSdf.getMesh();
+    SimpleMesh *mesh = getMesh();
+    warpMesh(displacementField, mesh);
+    return mesh;
+}
+
+void SDF::warpMesh(const DisplacementField &displacementField, SimpleMesh *mesh) const
+{
+    // The deformed SDF at node x samples this SDF at x + displacement(x), thus a vertex at q of the mesh of this SDF
+    // moves to the x solving x + displacement(x) = q. Solved per vertex by the fixed point iteration of
+    // DisplacementField::invert.
+    std::vector<Vertex> &vertices = mesh->GetVertices();
+    int numVertices = vertices.size();
+    Eigen::Vector3d halfGridSize = (m_gridSize.cast<double>() / 2);
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (int i = 0; i < numVertices; i++)
+    {
+        // Undo the flip of y axis by SimpleMesh::AddVertex, and go back to grid nodes as in ProcessVolumeCell.
+        const Vertex &vertex = vertices[i];
+        Eigen::Vector3d meshLocation = (Eigen::Vector3d(vertex(0), -vertex(1), vertex(2)).array() + 1) * halfGridSize.array();
+        Eigen::Vector3d gridLocation = meshLocation - displacementField.getDisplacementAtf(meshLocation);
+        for (int iteration = 1; iteration < FIELD_INVERSION_ITERATIONS; iteration++)
+        {
+            Eigen::Vector3d nextGridLocation = meshLocation - displacementField.getDisplacementAtf(gridLocation);
+            double change = (nextGridLocation - gridLocation).norm();
+            gridLocation = nextGridLocation;
+            if (change < fieldInversionTolerance)
+                break;
+        }
+        Eigen::Vector3d deformedVertex = (gridLocation.array() / halfGridSize.array()) - 1;
+        vertices[i] = Vertex(deformedVertex(0), -deformedVertex(1), deformedVertex(2));
+    }
 }
 
 void SDF::save_mesh(std::string mesh_name_prefix,
                     int fileCounter,
                     const DisplacementField &displacementField) const
 {
-    SDF deformedSdf(m_voxelSize, m_min3dLoc, m_max3dLoc, m_unknownClipDistance);
-    deformedSdf.fuse(this, &displacementField);
-    deformedSdf.save_mesh(mesh_name_prefix, fileCounter);
+    std::ostringstream filenameOutStream;
+    filenameOutStream << OUTPUT_DIR << outputDir[datasetType] << mesh_name_prefix << std::setw(3) << std::setfill('0') << fileCounter << ".off";
+    std::string filenameOut = filenameOutStream.str();
+
+    SimpleMesh *mesh = getMesh(displacementField);
+    // write mesh to file
+    if (!mesh->WriteMesh(filenameOut))
+    {
+        std::cout << "ERROR: unable to write output file at" << filenameOut << "!" << std::endl;
+    }
+    delete mesh;
+}
+
+void SDF::testGetDeformedMesh()
+{
+    // A constant displacement moves the surface by its opposite, away from the grid boundary where it fades to zero.
+    double voxelSize = 0.5;
+    SDF sdf(voxelSize, Eigen::Vector3d(0, 0, 0), Eigen::Vector3d(10, 10, 10), UnknownClipDistance);
+    Eigen::Vector3d center = sdf.m_gridSize.cast<double>() / 2;
+    for (int z = 0; z < sdf.m_gridSize(2); z++)
+        for (int y = 0; y < sdf.m_gridSize(1); y++)
+            for (int x = 0; x < sdf.m_gridSize(0); x++)
+            {
+                int voxelIndex = z * sdf.m_gridSpacingPerAxis(2) + y * sdf.m_gridSpacingPerAxis(1) + x;
+                sdf.m_voxelGridTSDF[voxelIndex] = ((Eigen::Vector3d(x + 0.5, y + 0.5, z + 0.5) - center).norm() - 5) * VoxelSize;
+                sdf.m_voxelGridWeight[voxelIndex] = 1;
+            }
+    Eigen::Vector3d displacement(1.5, -0.5, 0.25);
+    DisplacementField displacementField(sdf.m_gridSize, voxelSize);
+    displacementField.initializeAllVoxels(displacement);
+
+    SimpleMesh *mesh = sdf.getMesh();
+    SimpleMesh *deformedMesh = sdf.getMesh(displacementField);
+    assert(mesh->GetVertices().size() == deformedMesh->GetVertices().size() && "Whoops, check SDF::getMesh(displacementField)");
+    Eigen::Vector3d halfGridSize = (sdf.m_gridSize.cast<double>() / 2);
+    for (size_t i = 0; i < mesh->GetVertices().size(); i++)
+    {
+        Eigen::Vector3d move = (deformedMesh->GetVertices()[i] - mesh->GetVertices()[i]).array() * halfGridSize.array();
+        assert((move - Eigen::Vector3d(-displacement(0), displacement(1), -displacement(2))).norm() < fieldInversionTolerance &&
+               "Whoops, check SDF::getMesh(displacementField)");
+    }
+    delete mesh;
+    delete deformedMesh;
 }
 
 void SDF::dumpToBinFile(string outputFilePath,
@@ -447,15 +920,8 @@ void SDF::dumpToBinFile(string outputFilePath,
     outFile.write((char *)(&m_voxelGridTSDF[0]), m_totalNumberOfVoxels * sizeof(double));
     outFile.close();
 
-    double min = m_voxelGridTSDF[0];
-    double max = m_voxelGridTSDF[0];
-    for (size_t i = 0; i < m_totalNumberOfVoxels; i++)
-    {
-        if (m_voxelGridTSDF[i] < min)
-            min = m_voxelGridTSDF[i];
-        else if (m_voxelGridTSDF[i] > max)
-            max = m_voxelGridTSDF[i];
-    }
+    double min, max;
+    VolumeOps::minMax(m_voxelGridTSDF.data(), m_totalNumberOfVoxels, min, max);
 
     cout << "Minimum SDF value is " << min << " and max value is " << max << "\n";
     cout << "TSDF voxel grid values saved at " << outputFilePath << "\n";
@@ -590,6 +1056,40 @@ double SDF::getDistancef(const Eigen::Vector3d &gridLocation,
     return getDistance(displacedGridLocation);
 }
 
+void SDF::getDistances(const Eigen::Vector3d *gridLocations, int count, double *distances) const
+{
+    double x[TrilinearSampler::MaxBatchSize], y[TrilinearSampler::MaxBatchSize], z[TrilinearSampler::MaxBatchSize];
+    for (int begin = 0; begin < count; begin += TrilinearSampler::MaxBatchSize)
+    {
+        int batchSize = min(count - begin, TrilinearSampler::MaxBatchSize);
+        // Substract 0.5 since, grid index (x,y,z) stores distance value for center (x,y,z)+(0.5,0.5,0.5)
+        for (int i = 0; i < batchSize; i++)
+        {
+            x[i] = gridLocations[begin + i](0) - 0.5;
+            y[i] = gridLocations[begin + i](1) - 0.5;
+            z[i] = gridLocations[begin + i](2) - 0.5;
+        }
+        TrilinearSampler::sampleScalarGrid(m_voxelGridTSDF.data(), m_gridSize, MaxSurfaceVoxelDistance + epsilon,
+                                           x, y, z, batchSize, distances + begin);
+    }
+}
+
+void SDF::getDistancesf(const Eigen::Vector3d *gridLocations,
+                        int count,
+                        const DisplacementField *displacementField,
+                        double *distances) const
+{
+    Eigen::Vector3d displacedGridLocations[TrilinearSampler::MaxBatchSize];
+    for (int begin = 0; begin < count; begin += TrilinearSampler::MaxBatchSize)
+    {
+        int batchSize = min(count - begin, TrilinearSampler::MaxBatchSize);
+        displacementField->getDisplacementsAtf(gridLocations + begin, batchSize, displacedGridLocations);
+        for (int i = 0; i < batchSize; i++)
+            displacedGridLocations[i] += gridLocations[begin + i] + Eigen::Vector3d(0.5, 0.5, 0.5);
+        getDistances(displacedGridLocations, batchSize, distances + begin);
+    }
+}
+
 double SDF::getWeight(const Eigen::Vector3d &gridLocation) const
 {
     // Substract 0.5 since, grid index (x,y,z) stores weight value for center (x,y,z)+(0.5,0.5,0.5)
@@ -739,20 +1239,13 @@ Eigen::Vector3d SDF::computeDistanceGradient(const Eigen::Vector3i &spatialIndex
 {
 	//spatialIndex idҪ+0.5
     Eigen::Vector3d gridLocation = spatialIndex.cast<double>() + Eigen::Vector3d(0.5, 0.5, 0.5);
-    const Eigen::Vector3d forwardDiffDelta[3] = {deltaSize * Eigen::Vector3d(1, 0, 0),
-                                                 deltaSize * Eigen::Vector3d(0, 1, 0),
-                                                 deltaSize * Eigen::Vector3d(0, 0, 1)};
-
-    Eigen::Vector3d gradient(0, 0, 0);
     // getDistance will take care of substracting 0.5, so pass gridLocation below
-    gradient(0) = getDistancef(gridLocation + forwardDiffDelta[0], displacementField) -
-                  getDistancef(gridLocation - forwardDiffDelta[0], displacementField);
-    gradient(1) = getDistancef(gridLocation + forwardDiffDelta[1], displacementField) -
-                  getDistancef(gridLocation - forwardDiffDelta[1], displacementField);
-    gradient(2) = getDistancef(gridLocation + forwardDiffDelta[2], displacementField) -
-                  getDistancef(gridLocation - forwardDiffDelta[2], displacementField);
-
-    return gradient / (2 * deltaSize);
+    Eigen::Vector3d sampleLocations[FiniteDifferences<double>::NumGradientSamples];
+    double samples[FiniteDifferences<double>::NumGradientSamples];
+    for (int i = 0; i < FiniteDifferences<double>::NumGradientSamples; i++)
+        sampleLocations[i] = gridLocation + deltaSize * FiniteDifferences<double>::gradientOffset(i);
+    getDistancesf(sampleLocations, FiniteDifferences<double>::NumGradientSamples, displacementField, samples);
+    return FiniteDifferences<double>::gradientFromSamples(samples);
 }
 
 Eigen::Matrix3d SDF::computeDistanceHessian(const Eigen::Vector3d &gridLocation) const
@@ -855,44 +1348,30 @@ Eigen::Matrix3d SDF::computeDistanceHessian(const Eigen::Vector3i &spatialIndex,
                                             const DisplacementField *displacementField) const
 {
     Eigen::Vector3d gridLocation = spatialIndex.cast<double>() + Eigen::Vector3d(0.5, 0.5, 0.5);
-    // ToDo: Optimize
-    double fxyz = getDistancef(gridLocation + deltaSize * Eigen::Vector3d(0, 0, 0), displacementField);
-    double fxplus2yz = getDistancef(gridLocation + deltaSize * Eigen::Vector3d(2, 0, 0), displacementField);
-    double fxminus2yz = getDistancef(gridLocation + deltaSize * Eigen::Vector3d(-2, 0, 0), displacementField);
-    double fxyplus2z = getDistancef(gridLocation + deltaSize * Eigen::Vector3d(0, 2, 0), displacementField);
-    double fxyminus2z = getDistancef(gridLocation + deltaSize * Eigen::Vector3d(0, -2, 0), displacementField);
-    double fxyzplus2 = getDistancef(gridLocation + deltaSize * Eigen::Vector3d(0, 0, 2), displacementField);
-    double fxyzminus2 = getDistancef(gridLocation + deltaSize * Eigen::Vector3d(0, 0, -2), displacementField);
-    double fxplus1yzplus1 = getDistancef(gridLocation + deltaSize * Eigen::Vector3d(1, 0, 1), displacementField);
-    double fxminus1yzplus1 = getDistancef(gridLocation + deltaSize * Eigen::Vector3d(-1, 0, 1), displacementField);
-    double fxyplus1zplus1 = getDistancef(gridLocation + deltaSize * Eigen::Vector3d(0, 1, 1), displacementField);
-    double fxyminus1zplus1 = getDistancef(gridLocation + deltaSize * Eigen::Vector3d(0, -1, 1), displacementField);
-    double fxplus1yplus1z = getDistancef(gridLocation + deltaSize * Eigen::Vector3d(1, 1, 0), displacementField);
-    double fxminus1yplus1z = getDistancef(gridLocation + deltaSize * Eigen::Vector3d(-1, 1, 0), displacementField);
-    double fxminus1yzminus1 = getDistancef(gridLocation + deltaSize * Eigen::Vector3d(-1, 0, -1), displacementField);
-    double fxplus1yzminus1 = getDistancef(gridLocation + deltaSize * Eigen::Vector3d(1, 0, -1), displacementField);
-    double fxyminus1zminus1 = getDistancef(gridLocation + deltaSize * Eigen::Vector3d(0, -1, -1), displacementField);
-    double fxyplus1zminus1 = getDistancef(gridLocation + deltaSize * Eigen::Vector3d(0, 1, -1), displacementField);
-    double fxminus1yminus1z = getDistancef(gridLocation + deltaSize * Eigen::Vector3d(-1, -1, 0), displacementField);
-    double fxplus1yminus1z = getDistancef(gridLocation + deltaSize * Eigen::Vector3d(1, -1, 0), displacementField);
-
-    double fxx, fyy, fzz, fxy, fxz, fyz;
-    fxx = (fxplus2yz - 2 * fxyz + fxminus2yz);
-    fyy = (fxyplus2z - 2 * fxyz + fxyminus2z);
-    fzz = (fxyzplus2 - 2 * fxyz + fxyzminus2);
-    fxz = (fxplus1yzplus1 + fxminus1yzminus1 - fxplus1yzminus1 - fxminus1yzplus1);
-    fyz = (fxyplus1zplus1 + fxyminus1zminus1 - fxyplus1zminus1 - fxyminus1zplus1);
-    fxy = (fxplus1yplus1z + fxminus1yminus1z - fxplus1yminus1z - fxminus1yplus1z);
-
-    Eigen::Matrix3d hessian;
-    hessian(0, 0) = fxx;
-    hessian(1, 1) = fyy;
-    hessian(2, 2) = fzz;
-    hessian(0, 1) = hessian(1, 0) = fxy;
-    hessian(0, 2) = hessian(2, 0) = fxz;
-    hessian(1, 2) = hessian(2, 1) = fyz;
+    // All samples of the stencil in one batch.
+    Eigen::Vector3d sampleLocations[FiniteDifferences<double>::NumHessianSamples];
+    double samples[FiniteDifferences<double>::NumHessianSamples];
+    for (int i = 0; i < FiniteDifferences<double>::NumHessianSamples; i++)
+        sampleLocations[i] = gridLocation + deltaSize * FiniteDifferences<double>::hessianOffset(i);
+    getDistancesf(sampleLocations, FiniteDifferences<double>::NumHessianSamples, displacementField, samples);
+    return FiniteDifferences<double>::hessianFromSamples(samples);
+}
 
-    // Dividing by denominator in real distance causes floating precision errors. Keep unit in voxel size.
-    double denominator = (4 * deltaSize * deltaSize); // 4h^2, where h is step size.
-    return hessian / denominator;
+void SDF::computeDistanceGradientAndHessian(const Eigen::Vector3i &spatialIndex,
+                                            const DisplacementField *displacementField,
+                                            Eigen::Vector3d &gradient,
+                                            Eigen::Matrix3d &hessian) const
+{
+    // The samples of computeDistanceGradient followed by the ones of computeDistanceHessian, in one batch.
+    typedef FiniteDifferences<double> Stencil;
+    Eigen::Vector3d gridLocation = spatialIndex.cast<double>() + Eigen::Vector3d(0.5, 0.5, 0.5);
+    Eigen::Vector3d sampleLocations[Stencil::NumGradientSamples + Stencil::NumHessianSamples];
+    double samples[Stencil::NumGradientSamples + Stencil::NumHessianSamples];
+    for (int i = 0; i < Stencil::NumGradientSamples; i++)
+        sampleLocations[i] = gridLocation + deltaSize * Stencil::gradientOffset(i);
+    for (int i = 0; i < Stencil::NumHessianSamples; i++)
+        sampleLocations[Stencil::NumGradientSamples + i] = gridLocation + deltaSize * Stencil::hessianOffset(i);
+    getDistancesf(sampleLocations, Stencil::NumGradientSamples + Stencil::NumHessianSamples, displacementField, samples);
+    gradient = Stencil::gradientFromSamples(samples);
+    hessian = Stencil::hessianFromSamples(samples + Stencil::NumGradientSamples);
 }
@@ -0,0 +1,181 @@
+#include "SobolevFusion.h"
+#include "config.h"
+#include "ConvergenceMonitor.h"
+using namespace std;
+
+SobolevFusion::SobolevFusion(DatasetReader datasetReader)
+    : VariationalFusion(datasetReader)
+{
+  computeSobolevKernel();
+}
+
+void SobolevFusion::computeSobolevKernel()
+{
+  // Response of (Id - sobolevLambda * laplacian) to an impulse at the center of a 1D grid of SOBOLEV_KERNEL_SIZE.
+  int kernelSize = SOBOLEV_KERNEL_SIZE;
+  Eigen::MatrixXd sobolevSystem = Eigen::MatrixXd::Identity(kernelSize, kernelSize);
+  for (int i = 0; i < kernelSize; i++)
+  {
+    sobolevSystem(i, i) += 2 * sobolevLambda;
+    if (i > 0)
+      sobolevSystem(i, i - 1) = -sobolevLambda;
+    if (i < kernelSize - 1)
+      sobolevSystem(i, i + 1) = -sobolevLambda;
+  }
+  Eigen::VectorXd impulse = Eigen::VectorXd::Zero(kernelSize);
+  impulse(kernelSize / 2) = 1;
+  Eigen::VectorXd kernel = sobolevSystem.ldlt().solve(impulse);
+  kernel /= kernel.sum(); // Smoothing should not change the magnitude of a constant gradient.
+  m_sobolevKernel.assign(kernel.data(), kernel.data() + kernelSize);
+}
+
+void SobolevFusion::convolveAlongAxis(const vector<double> &in,
+                                      vector<double> &out,
+                                      const Eigen::Vector3i &gridSize,
+                                      int axis) const
+{
+  // Every pass runs along contiguous x rows, so that the inner loop vectorizes for all three axes.
+  // For axis 0 the kernel shifts inside the row, else it picks the neighbouring row.
+  const int radius = m_sobolevKernel.size() / 2;
+  const Eigen::Vector3i gridSpacingPerAxis(1, gridSize(0), gridSize(0) * gridSize(1));
+  const double *inData = in.data();
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+  for (int z = 0; z < gridSize(2); z++)
+  {
+    for (int y = 0; y < gridSize(1); y++)
+    {
+      const int rowIndex = z * gridSpacingPerAxis(2) + y * gridSpacingPerAxis(1);
+      double *outRow = &out[rowIndex];
+      std::fill(outRow, outRow + gridSize(0), 0.0);
+      for (int k = -radius; k <= radius; k++)
+      {
+        const double weight = m_sobolevKernel[k + radius];
+        int xStart = 0, xEnd = gridSize(0);
+        if (axis == 0)
+        {
+          xStart = max(0, -k);
+          xEnd = min(gridSize(0), gridSize(0) - k);
+        }
+        else
+        {
+          int neighbour = (axis == 1 ? y : z) + k;
+          if (neighbour < 0 || neighbour >= gridSize(axis))
+            continue;
+        }
+        const int inRowIndex = rowIndex + k * gridSpacingPerAxis(axis);
+#ifndef DISABLE_OPENMP
+#pragma omp simd
+#endif
+        for (int x = xStart; x < xEnd; x++)
+          outRow[x] += weight * inData[inRowIndex + x];
+      }
+    }
+  }
+}
+
+void SobolevFusion::computeDisplacementField(const SDF *src,
+                                             const SDF *dest,
+                                             DisplacementField *srcToDest)
+{
+  Eigen::Vector3i srcGridSize = src->getGridSize();
+  int totalNumberOfVoxels = srcGridSize.prod();
+  // Gradient field stored per component, so that convolution runs over contiguous doubles.
+  vector<double> gradient[3], smoothedGradient[3];
+  for (int i = 0; i < 3; i++)
+  {
+    gradient[i].resize(totalNumberOfVoxels);
+    smoothedGradient[i].resize(totalNumberOfVoxels);
+  }
+  vector<double> voxelUpdateNorm(totalNumberOfVoxels);
+
+  // Killing energy is not optimized, the Sobolev kernel takes its place.
+  const bool energyTypeUsed[3] = {EnergyTypeUsed[0], EnergyTypeUsed[1], false};
+  ConvergenceMonitor monitor("Sobolev", energyTypeUsed);
+
+  for (int iter = 0; iter < KILLING_MAX_ITERATIONS; iter++)
+  {
+    // L2 gradient of Data and LevelSet energy. Zero away from the surface.
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int z = 0; z < srcGridSize(2); z++)
+    {
+      for (int y = 0; y < srcGridSize(1); y++)
+      {
+        for (int x = 0; x < srcGridSize(0); x++)
+        {
+          const Eigen::Vector3i spatialIndex(x, y, z);
+          int voxelIndex = z * srcGridSize(0) * srcGridSize(1) + y * srcGridSize(0) + x;
+          Eigen::Vector3d voxelGradient(0, 0, 0);
+          double srcSdfDistance = src->getDistance(spatialIndex, srcToDest);
+          if (srcSdfDistance <= MaxSurfaceVoxelDistance - epsilon && srcSdfDistance >= -UnknownClipDistance)
+          {
+            Eigen::Vector3d dataGradient, levelSetGradient;
+            computeDataAndLevelSetEnergyGradient(src, dest, srcToDest, spatialIndex, srcSdfDistance,
+                                                 EnergyTypeUsed[0], EnergyTypeUsed[1], dataGradient, levelSetGradient);
+            voxelGradient += dataGradient + levelSetGradient;
+          }
+          for (int i = 0; i < 3; i++)
+            gradient[i][voxelIndex] = voxelGradient(i);
+        }
+      }
+    }
+
+    // Sobolev gradient - Separable convolution along x, then y, then z.
+    for (int i = 0; i < 3; i++)
+    {
+      convolveAlongAxis(gradient[i], smoothedGradient[i], srcGridSize, 0);
+      convolveAlongAxis(smoothedGradient[i], gradient[i], srcGridSize, 1);
+      convolveAlongAxis(gradient[i], smoothedGradient[i], srcGridSize, 2);
+    }
+
+    // Smoothed gradient also moves voxels near the band, thus update the whole field.
+    bool updateIsFinite = true;
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for schedule(static) reduction(&& : updateIsFinite)
+#endif
+    for (int z = 0; z < srcGridSize(2); z++)
+    {
+      for (int y = 0; y < srcGridSize(1); y++)
+      {
+        for (int x = 0; x < srcGridSize(0); x++)
+        {
+          int voxelIndex = z * srcGridSize(0) * srcGridSize(1) + y * srcGridSize(0) + x;
+          Eigen::Vector3d displacementUpdate = -alpha * Eigen::Vector3d(smoothedGradient[0][voxelIndex],
+                                                                        smoothedGradient[1][voxelIndex],
+                                                                        smoothedGradient[2][voxelIndex]);
+          voxelUpdateNorm[voxelIndex] = -1;
+          if (displacementUpdate.isZero(0))
+            continue;
+          updateIsFinite = updateIsFinite && displacementUpdate.array().isFinite().all();
+          voxelUpdateNorm[voxelIndex] = displacementUpdate.norm();
+          srcToDest->update(Eigen::Vector3i(x, y, z), displacementUpdate);
+        }
+      }
+    }
+
+    // perform check on deformation field to see if it has diverged. Ideally shouldn't happen
+    if (!updateIsFinite)
+    {
+      std::cout << "Error: deformation field has diverged in Sobolev iteration " << iter << std::endl;
+      throw - 1;
+    }
+
+    IterationStatistics stats;
+    stats.iteration = iter;
+    vector<double> updateNorms;
+    for (double updateNorm : voxelUpdateNorm)
+    {
+      if (updateNorm >= 0)
+        updateNorms.push_back(updateNorm);
+    }
+    stats.numActiveVoxels = updateNorms.size();
+    ConvergenceMonitor::computeUpdateStatistics(updateNorms, stats);
+    if (monitor.isEnergyRequired())
+      monitor.computeEnergy(src, dest, srcToDest, stats);
+    if (monitor.hasConverged(stats))
+      break;
+  }
+}
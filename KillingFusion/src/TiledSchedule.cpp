@@ -0,0 +1,43 @@
+#include "TiledSchedule.h"
+using namespace std;
+
+TiledSchedule::TiledSchedule(const Eigen::Vector3i &gridSize, int tileSize)
+    : m_gridSize(gridSize),
+      m_tileSize(tileSize)
+{
+  for (int i = 0; i < 3; i++)
+    m_numTilesPerAxis(i) = (m_gridSize(i) + m_tileSize - 1) / m_tileSize;
+  m_tileOffsets.assign(1, 0);
+}
+
+void TiledSchedule::build(const vector<int> &voxelIndices)
+{
+  // Counting sort of voxels by their tile.
+  int numVoxels = voxelIndices.size();
+  vector<int> voxelTile(numVoxels);
+  vector<int> tileStart(m_numTilesPerAxis.prod() + 1, 0);
+  for (int i = 0; i < numVoxels; i++)
+  {
+    int voxelIndex = voxelIndices[i];
+    int x = voxelIndex % m_gridSize(0);
+    int y = (voxelIndex / m_gridSize(0)) % m_gridSize(1);
+    int z = voxelIndex / (m_gridSize(0) * m_gridSize(1));
+    voxelTile[i] = ((z / m_tileSize) * m_numTilesPerAxis(1) + y / m_tileSize) * m_numTilesPerAxis(0) + x / m_tileSize;
+    tileStart[voxelTile[i] + 1]++;
+  }
+  for (size_t tile = 1; tile < tileStart.size(); tile++)
+    tileStart[tile] += tileStart[tile - 1];
+
+  // Empty tiles get no entry in m_tileOffsets.
+  m_tileOffsets.clear();
+  for (size_t tile = 0; tile + 1 < tileStart.size(); tile++)
+  {
+    if (tileStart[tile + 1] > tileStart[tile])
+      m_tileOffsets.push_back(tileStart[tile]);
+  }
+  m_tileOffsets.push_back(numVoxels);
+
+  m_tileVoxels.resize(numVoxels);
+  for (int i = 0; i < numVoxels; i++)
+    m_tileVoxels[tileStart[voxelTile[i]]++] = voxelIndices[i];
+}
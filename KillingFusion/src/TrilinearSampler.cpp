@@ -0,0 +1,544 @@
+#include "TrilinearSampler.h"
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include "config.h"
+#include "utils.h"
+using namespace std;
+
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(DISABLE_SIMD)
+#define TRILINEAR_SAMPLER_X86
+#include <immintrin.h>
+#endif
+
+// Vector grid is read as consecutive scalars x, y, z per voxel.
+static_assert(sizeof(Eigen::Vector3d) == 3 * sizeof(double), "Eigen::Vector3d must not be padded");
+static_assert(sizeof(Eigen::Vector3f) == 3 * sizeof(float), "Eigen::Vector3f must not be padded");
+
+namespace
+{
+template <typename Scalar>
+using ScalarGridSampler = void (*)(const Scalar *, const Eigen::Vector3i &, Scalar,
+                                   const Scalar *, const Scalar *, const Scalar *, int, int, Scalar *);
+template <typename Scalar>
+using VectorGridSampler = void (*)(const Scalar *, const Eigen::Vector3i &,
+                                   const Scalar *, const Scalar *, const Scalar *, int, int, Scalar *);
+
+// Points in [begin, end) with interpolate3D. Index is truncated towards zero, as cast<int> does in SDF::getDistance.
+template <typename Scalar>
+void sampleScalarGridScalar(const Scalar *grid, const Eigen::Vector3i &gridSize, Scalar outsideValue,
+                            const Scalar *x, const Scalar *y, const Scalar *z, int begin, int end, Scalar *values)
+{
+  auto at = [&](int ix, int iy, int iz) {
+    if (ix < 0 || ix >= gridSize(0) || iy < 0 || iy >= gridSize(1) || iz < 0 || iz >= gridSize(2))
+      return outsideValue;
+    return grid[iz * gridSize(0) * gridSize(1) + iy * gridSize(0) + ix];
+  };
+  for (int i = begin; i < end; i++)
+  {
+    int ix = int(x[i]), iy = int(y[i]), iz = int(z[i]);
+    values[i] = interpolate3D(at(ix, iy, iz), at(ix + 1, iy, iz), at(ix, iy + 1, iz), at(ix + 1, iy + 1, iz),
+                              at(ix, iy, iz + 1), at(ix + 1, iy, iz + 1), at(ix, iy + 1, iz + 1), at(ix + 1, iy + 1, iz + 1),
+                              x[i] - ix, y[i] - iy, z[i] - iz);
+  }
+}
+
+template <typename Scalar>
+void sampleVectorGridScalar(const Scalar *grid, const Eigen::Vector3i &gridSize,
+                            const Scalar *x, const Scalar *y, const Scalar *z, int begin, int end, Scalar *values)
+{
+  typedef Eigen::Matrix<Scalar, 3, 1> Vector3;
+  int totalNumberOfVoxels = gridSize.prod();
+  auto at = [&](int ix, int iy, int iz) {
+    int index = iz * gridSize(0) * gridSize(1) + iy * gridSize(0) + ix;
+    if (index < 0 || index >= totalNumberOfVoxels)
+      return Vector3(0, 0, 0);
+    return Vector3(grid[3 * index], grid[3 * index + 1], grid[3 * index + 2]);
+  };
+  for (int i = begin; i < end; i++)
+  {
+    int ix = int(x[i]), iy = int(y[i]), iz = int(z[i]);
+    Vector3 value = interpolate3DVectors(at(ix, iy, iz), at(ix + 1, iy, iz), at(ix, iy + 1, iz), at(ix + 1, iy + 1, iz),
+                                         at(ix, iy, iz + 1), at(ix + 1, iy, iz + 1), at(ix, iy + 1, iz + 1), at(ix + 1, iy + 1, iz + 1),
+                                         x[i] - ix, y[i] - iy, z[i] - iz);
+    for (int k = 0; k < 3; k++)
+      values[3 * i + k] = value(k);
+  }
+}
+
+#ifdef TRILINEAR_SAMPLER_X86
+// Corner c of a cell is (c & 1, c >> 1 & 1, c >> 2 & 1), the argument order of interpolate3D.
+
+__attribute__((target("avx2,fma"))) inline __m256d lerpAvx2(__m256d a, __m256d b, __m256d w)
+{
+  return _mm256_fmadd_pd(b, w, _mm256_mul_pd(a, _mm256_sub_pd(_mm256_set1_pd(1), w)));
+}
+
+__attribute__((target("avx2,fma"))) inline __m256d interpolateAvx2(const __m256d corner[8], __m256d wx, __m256d wy, __m256d wz)
+{
+  __m256d s = lerpAvx2(lerpAvx2(corner[0], corner[1], wx), lerpAvx2(corner[2], corner[3], wx), wy);
+  __m256d t = lerpAvx2(lerpAvx2(corner[4], corner[5], wx), lerpAvx2(corner[6], corner[7], wx), wy);
+  return lerpAvx2(s, t, wz);
+}
+
+__attribute__((target("avx2,fma"))) inline __m256 lerpAvx2(__m256 a, __m256 b, __m256 w)
+{
+  return _mm256_fmadd_ps(b, w, _mm256_mul_ps(a, _mm256_sub_ps(_mm256_set1_ps(1), w)));
+}
+
+__attribute__((target("avx2,fma"))) inline __m256 interpolateAvx2(const __m256 corner[8], __m256 wx, __m256 wy, __m256 wz)
+{
+  __m256 s = lerpAvx2(lerpAvx2(corner[0], corner[1], wx), lerpAvx2(corner[2], corner[3], wx), wy);
+  __m256 t = lerpAvx2(lerpAvx2(corner[4], corner[5], wx), lerpAvx2(corner[6], corner[7], wx), wy);
+  return lerpAvx2(s, t, wz);
+}
+
+// Lanes where 0 <= index < size are all ones.
+__attribute__((target("avx2"))) inline __m128i inRange128(__m128i index, __m128i size)
+{
+  return _mm_and_si128(_mm_cmpgt_epi32(index, _mm_set1_epi32(-1)), _mm_cmpgt_epi32(size, index));
+}
+
+__attribute__((target("avx2"))) inline __m256i inRange256(__m256i index, __m256i size)
+{
+  return _mm256_and_si256(_mm256_cmpgt_epi32(index, _mm256_set1_epi32(-1)), _mm256_cmpgt_epi32(size, index));
+}
+
+__attribute__((target("avx2,fma")))
+void sampleScalarGridAvx2(const double *grid, const Eigen::Vector3i &gridSize, double outsideValue,
+                          const double *x, const double *y, const double *z, int begin, int end, double *values)
+{
+  const __m128i sizeX = _mm_set1_epi32(gridSize(0)), sizeY = _mm_set1_epi32(gridSize(1)), sizeZ = _mm_set1_epi32(gridSize(2));
+  const __m128i strideY = _mm_set1_epi32(gridSize(0)), strideZ = _mm_set1_epi32(gridSize(0) * gridSize(1));
+  const __m256d outside = _mm256_set1_pd(outsideValue);
+  int i = begin;
+  for (; i + 4 <= end; i += 4)
+  {
+    __m256d px = _mm256_loadu_pd(x + i), py = _mm256_loadu_pd(y + i), pz = _mm256_loadu_pd(z + i);
+    __m128i ix = _mm256_cvttpd_epi32(px), iy = _mm256_cvttpd_epi32(py), iz = _mm256_cvttpd_epi32(pz);
+    __m256d corner[8];
+    for (int c = 0; c < 8; c++)
+    {
+      __m128i cx = _mm_add_epi32(ix, _mm_set1_epi32(c & 1));
+      __m128i cy = _mm_add_epi32(iy, _mm_set1_epi32(c >> 1 & 1));
+      __m128i cz = _mm_add_epi32(iz, _mm_set1_epi32(c >> 2 & 1));
+      __m128i inside = _mm_and_si128(inRange128(cx, sizeX), _mm_and_si128(inRange128(cy, sizeY), inRange128(cz, sizeZ)));
+      __m128i index = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(cz, strideZ), _mm_mullo_epi32(cy, strideY)), cx);
+      corner[c] = _mm256_mask_i32gather_pd(outside, grid, index, _mm256_castsi256_pd(_mm256_cvtepi32_epi64(inside)), 8);
+    }
+    __m256d wx = _mm256_sub_pd(px, _mm256_cvtepi32_pd(ix));
+    __m256d wy = _mm256_sub_pd(py, _mm256_cvtepi32_pd(iy));
+    __m256d wz = _mm256_sub_pd(pz, _mm256_cvtepi32_pd(iz));
+    _mm256_storeu_pd(values + i, interpolateAvx2(corner, wx, wy, wz));
+  }
+  sampleScalarGridScalar(grid, gridSize, outsideValue, x, y, z, i, end, values);
+}
+
+__attribute__((target("avx2,fma")))
+void sampleVectorGridAvx2(const double *grid, const Eigen::Vector3i &gridSize,
+                          const double *x, const double *y, const double *z, int begin, int end, double *values)
+{
+  const __m128i totalNumberOfVoxels = _mm_set1_epi32(gridSize.prod());
+  const __m128i strideY = _mm_set1_epi32(gridSize(0)), strideZ = _mm_set1_epi32(gridSize(0) * gridSize(1));
+  int i = begin;
+  for (; i + 4 <= end; i += 4)
+  {
+    __m256d px = _mm256_loadu_pd(x + i), py = _mm256_loadu_pd(y + i), pz = _mm256_loadu_pd(z + i);
+    __m128i ix = _mm256_cvttpd_epi32(px), iy = _mm256_cvttpd_epi32(py), iz = _mm256_cvttpd_epi32(pz);
+    __m256d corner[3][8];
+    for (int c = 0; c < 8; c++)
+    {
+      __m128i cx = _mm_add_epi32(ix, _mm_set1_epi32(c & 1));
+      __m128i cy = _mm_add_epi32(iy, _mm_set1_epi32(c >> 1 & 1));
+      __m128i cz = _mm_add_epi32(iz, _mm_set1_epi32(c >> 2 & 1));
+      __m128i index = _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(cz, strideZ), _mm_mullo_epi32(cy, strideY)), cx);
+      __m256d mask = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(inRange128(index, totalNumberOfVoxels)));
+      __m128i componentIndex = _mm_mullo_epi32(index, _mm_set1_epi32(3));
+      for (int k = 0; k < 3; k++)
+        corner[k][c] = _mm256_mask_i32gather_pd(_mm256_setzero_pd(), grid + k, componentIndex, mask, 8);
+    }
+    __m256d wx = _mm256_sub_pd(px, _mm256_cvtepi32_pd(ix));
+    __m256d wy = _mm256_sub_pd(py, _mm256_cvtepi32_pd(iy));
+    __m256d wz = _mm256_sub_pd(pz, _mm256_cvtepi32_pd(iz));
+    double component[3][4];
+    for (int k = 0; k < 3; k++)
+      _mm256_storeu_pd(component[k], interpolateAvx2(corner[k], wx, wy, wz));
+    for (int lane = 0; lane < 4; lane++)
+      for (int k = 0; k < 3; k++)
+        values[3 * (i + lane) + k] = component[k][lane];
+  }
+  sampleVectorGridScalar(grid, gridSize, x, y, z, i, end, values);
+}
+
+// Float variants gather 8 points per AVX2 register, twice the doubles.
+__attribute__((target("avx2,fma")))
+void sampleScalarGridAvx2(const float *grid, const Eigen::Vector3i &gridSize, float outsideValue,
+                          const float *x, const float *y, const float *z, int begin, int end, float *values)
+{
+  const __m256i sizeX = _mm256_set1_epi32(gridSize(0)), sizeY = _mm256_set1_epi32(gridSize(1)), sizeZ = _mm256_set1_epi32(gridSize(2));
+  const __m256i strideY = _mm256_set1_epi32(gridSize(0)), strideZ = _mm256_set1_epi32(gridSize(0) * gridSize(1));
+  const __m256 outside = _mm256_set1_ps(outsideValue);
+  int i = begin;
+  for (; i + 8 <= end; i += 8)
+  {
+    __m256 px = _mm256_loadu_ps(x + i), py = _mm256_loadu_ps(y + i), pz = _mm256_loadu_ps(z + i);
+    __m256i ix = _mm256_cvttps_epi32(px), iy = _mm256_cvttps_epi32(py), iz = _mm256_cvttps_epi32(pz);
+    __m256 corner[8];
+    for (int c = 0; c < 8; c++)
+    {
+      __m256i cx = _mm256_add_epi32(ix, _mm256_set1_epi32(c & 1));
+      __m256i cy = _mm256_add_epi32(iy, _mm256_set1_epi32(c >> 1 & 1));
+      __m256i cz = _mm256_add_epi32(iz, _mm256_set1_epi32(c >> 2 & 1));
+      __m256i inside = _mm256_and_si256(inRange256(cx, sizeX), _mm256_and_si256(inRange256(cy, sizeY), inRange256(cz, sizeZ)));
+      __m256i index = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(cz, strideZ), _mm256_mullo_epi32(cy, strideY)), cx);
+      corner[c] = _mm256_mask_i32gather_ps(outside, grid, index, _mm256_castsi256_ps(inside), 4);
+    }
+    __m256 wx = _mm256_sub_ps(px, _mm256_cvtepi32_ps(ix));
+    __m256 wy = _mm256_sub_ps(py, _mm256_cvtepi32_ps(iy));
+    __m256 wz = _mm256_sub_ps(pz, _mm256_cvtepi32_ps(iz));
+    _mm256_storeu_ps(values + i, interpolateAvx2(corner, wx, wy, wz));
+  }
+  sampleScalarGridScalar(grid, gridSize, outsideValue, x, y, z, i, end, values);
+}
+
+__attribute__((target("avx2,fma")))
+void sampleVectorGridAvx2(const float *grid, const Eigen::Vector3i &gridSize,
+                          const float *x, const float *y, const float *z, int begin, int end, float *values)
+{
+  const __m256i totalNumberOfVoxels = _mm256_set1_epi32(gridSize.prod());
+  const __m256i strideY = _mm256_set1_epi32(gridSize(0)), strideZ = _mm256_set1_epi32(gridSize(0) * gridSize(1));
+  int i = begin;
+  for (; i + 8 <= end; i += 8)
+  {
+    __m256 px = _mm256_loadu_ps(x + i), py = _mm256_loadu_ps(y + i), pz = _mm256_loadu_ps(z + i);
+    __m256i ix = _mm256_cvttps_epi32(px), iy = _mm256_cvttps_epi32(py), iz = _mm256_cvttps_epi32(pz);
+    __m256 corner[3][8];
+    for (int c = 0; c < 8; c++)
+    {
+      __m256i cx = _mm256_add_epi32(ix, _mm256_set1_epi32(c & 1));
+      __m256i cy = _mm256_add_epi32(iy, _mm256_set1_epi32(c >> 1 & 1));
+      __m256i cz = _mm256_add_epi32(iz, _mm256_set1_epi32(c >> 2 & 1));
+      __m256i index = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(cz, strideZ), _mm256_mullo_epi32(cy, strideY)), cx);
+      __m256 mask = _mm256_castsi256_ps(inRange256(index, totalNumberOfVoxels));
+      __m256i componentIndex = _mm256_mullo_epi32(index, _mm256_set1_epi32(3));
+      for (int k = 0; k < 3; k++)
+        corner[k][c] = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), grid + k, componentIndex, mask, 4);
+    }
+    __m256 wx = _mm256_sub_ps(px, _mm256_cvtepi32_ps(ix));
+    __m256 wy = _mm256_sub_ps(py, _mm256_cvtepi32_ps(iy));
+    __m256 wz = _mm256_sub_ps(pz, _mm256_cvtepi32_ps(iz));
+    float component[3][8];
+    for (int k = 0; k < 3; k++)
+      _mm256_storeu_ps(component[k], interpolateAvx2(corner[k], wx, wy, wz));
+    for (int lane = 0; lane < 8; lane++)
+      for (int k = 0; k < 3; k++)
+        values[3 * (i + lane) + k] = component[k][lane];
+  }
+  sampleVectorGridScalar(grid, gridSize, x, y, z, i, end, values);
+}
+
+__attribute__((target("avx512f,avx2,fma"))) inline __m512d lerpAvx512(__m512d a, __m512d b, __m512d w)
+{
+  return _mm512_fmadd_pd(b, w, _mm512_mul_pd(a, _mm512_sub_pd(_mm512_set1_pd(1), w)));
+}
+
+__attribute__((target("avx512f,avx2,fma"))) inline __m512d interpolateAvx512(const __m512d corner[8], __m512d wx, __m512d wy, __m512d wz)
+{
+  __m512d s = lerpAvx512(lerpAvx512(corner[0], corner[1], wx), lerpAvx512(corner[2], corner[3], wx), wy);
+  __m512d t = lerpAvx512(lerpAvx512(corner[4], corner[5], wx), lerpAvx512(corner[6], corner[7], wx), wy);
+  return lerpAvx512(s, t, wz);
+}
+
+__attribute__((target("avx512f,avx2,fma"))) inline __mmask8 toMask8(__m256i mask)
+{
+  return __mmask8(_mm256_movemask_ps(_mm256_castsi256_ps(mask)));
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+void sampleScalarGridAvx512(const double *grid, const Eigen::Vector3i &gridSize, double outsideValue,
+                            const double *x, const double *y, const double *z, int begin, int end, double *values)
+{
+  const __m256i sizeX = _mm256_set1_epi32(gridSize(0)), sizeY = _mm256_set1_epi32(gridSize(1)), sizeZ = _mm256_set1_epi32(gridSize(2));
+  const __m256i strideY = _mm256_set1_epi32(gridSize(0)), strideZ = _mm256_set1_epi32(gridSize(0) * gridSize(1));
+  const __m512d outside = _mm512_set1_pd(outsideValue);
+  int i = begin;
+  for (; i + 8 <= end; i += 8)
+  {
+    __m512d px = _mm512_loadu_pd(x + i), py = _mm512_loadu_pd(y + i), pz = _mm512_loadu_pd(z + i);
+    __m256i ix = _mm512_cvttpd_epi32(px), iy = _mm512_cvttpd_epi32(py), iz = _mm512_cvttpd_epi32(pz);
+    __m512d corner[8];
+    for (int c = 0; c < 8; c++)
+    {
+      __m256i cx = _mm256_add_epi32(ix, _mm256_set1_epi32(c & 1));
+      __m256i cy = _mm256_add_epi32(iy, _mm256_set1_epi32(c >> 1 & 1));
+      __m256i cz = _mm256_add_epi32(iz, _mm256_set1_epi32(c >> 2 & 1));
+      __m256i inside = _mm256_and_si256(inRange256(cx, sizeX), _mm256_and_si256(inRange256(cy, sizeY), inRange256(cz, sizeZ)));
+      __m256i index = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(cz, strideZ), _mm256_mullo_epi32(cy, strideY)), cx);
+      corner[c] = _mm512_mask_i32gather_pd(outside, toMask8(inside), index, grid, 8);
+    }
+    __m512d wx = _mm512_sub_pd(px, _mm512_cvtepi32_pd(ix));
+    __m512d wy = _mm512_sub_pd(py, _mm512_cvtepi32_pd(iy));
+    __m512d wz = _mm512_sub_pd(pz, _mm512_cvtepi32_pd(iz));
+    _mm512_storeu_pd(values + i, interpolateAvx512(corner, wx, wy, wz));
+  }
+  sampleScalarGridAvx2(grid, gridSize, outsideValue, x, y, z, i, end, values);
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+void sampleVectorGridAvx512(const double *grid, const Eigen::Vector3i &gridSize,
+                            const double *x, const double *y, const double *z, int begin, int end, double *values)
+{
+  const __m256i totalNumberOfVoxels = _mm256_set1_epi32(gridSize.prod());
+  const __m256i strideY = _mm256_set1_epi32(gridSize(0)), strideZ = _mm256_set1_epi32(gridSize(0) * gridSize(1));
+  int i = begin;
+  for (; i + 8 <= end; i += 8)
+  {
+    __m512d px = _mm512_loadu_pd(x + i), py = _mm512_loadu_pd(y + i), pz = _mm512_loadu_pd(z + i);
+    __m256i ix = _mm512_cvttpd_epi32(px), iy = _mm512_cvttpd_epi32(py), iz = _mm512_cvttpd_epi32(pz);
+    __m512d corner[3][8];
+    for (int c = 0; c < 8; c++)
+    {
+      __m256i cx = _mm256_add_epi32(ix, _mm256_set1_epi32(c & 1));
+      __m256i cy = _mm256_add_epi32(iy, _mm256_set1_epi32(c >> 1 & 1));
+      __m256i cz = _mm256_add_epi32(iz, _mm256_set1_epi32(c >> 2 & 1));
+      __m256i index = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(cz, strideZ), _mm256_mullo_epi32(cy, strideY)), cx);
+      __mmask8 mask = toMask8(inRange256(index, totalNumberOfVoxels));
+      __m256i componentIndex = _mm256_mullo_epi32(index, _mm256_set1_epi32(3));
+      for (int k = 0; k < 3; k++)
+        corner[k][c] = _mm512_mask_i32gather_pd(_mm512_setzero_pd(), mask, componentIndex, grid + k, 8);
+    }
+    __m512d wx = _mm512_sub_pd(px, _mm512_cvtepi32_pd(ix));
+    __m512d wy = _mm512_sub_pd(py, _mm512_cvtepi32_pd(iy));
+    __m512d wz = _mm512_sub_pd(pz, _mm512_cvtepi32_pd(iz));
+    double component[3][8];
+    for (int k = 0; k < 3; k++)
+      _mm512_storeu_pd(component[k], interpolateAvx512(corner[k], wx, wy, wz));
+    for (int lane = 0; lane < 8; lane++)
+      for (int k = 0; k < 3; k++)
+        values[3 * (i + lane) + k] = component[k][lane];
+  }
+  sampleVectorGridAvx2(grid, gridSize, x, y, z, i, end, values);
+}
+__attribute__((target("avx512f,avx2,fma"))) inline __m512 lerpAvx512(__m512 a, __m512 b, __m512 w)
+{
+  return _mm512_fmadd_ps(b, w, _mm512_mul_ps(a, _mm512_sub_ps(_mm512_set1_ps(1), w)));
+}
+
+__attribute__((target("avx512f,avx2,fma"))) inline __m512 interpolateAvx512(const __m512 corner[8], __m512 wx, __m512 wy, __m512 wz)
+{
+  __m512 s = lerpAvx512(lerpAvx512(corner[0], corner[1], wx), lerpAvx512(corner[2], corner[3], wx), wy);
+  __m512 t = lerpAvx512(lerpAvx512(corner[4], corner[5], wx), lerpAvx512(corner[6], corner[7], wx), wy);
+  return lerpAvx512(s, t, wz);
+}
+
+// Lanes where 0 <= index < size are set.
+__attribute__((target("avx512f,avx2,fma"))) inline __mmask16 inRange512(__m512i index, __m512i size)
+{
+  return _mm512_cmpgt_epi32_mask(index, _mm512_set1_epi32(-1)) & _mm512_cmpgt_epi32_mask(size, index);
+}
+
+// Float variants gather 16 points per AVX-512 register.
+__attribute__((target("avx512f,avx2,fma")))
+void sampleScalarGridAvx512(const float *grid, const Eigen::Vector3i &gridSize, float outsideValue,
+                            const float *x, const float *y, const float *z, int begin, int end, float *values)
+{
+  const __m512i sizeX = _mm512_set1_epi32(gridSize(0)), sizeY = _mm512_set1_epi32(gridSize(1)), sizeZ = _mm512_set1_epi32(gridSize(2));
+  const __m512i strideY = _mm512_set1_epi32(gridSize(0)), strideZ = _mm512_set1_epi32(gridSize(0) * gridSize(1));
+  const __m512 outside = _mm512_set1_ps(outsideValue);
+  int i = begin;
+  for (; i + 16 <= end; i += 16)
+  {
+    __m512 px = _mm512_loadu_ps(x + i), py = _mm512_loadu_ps(y + i), pz = _mm512_loadu_ps(z + i);
+    __m512i ix = _mm512_cvttps_epi32(px), iy = _mm512_cvttps_epi32(py), iz = _mm512_cvttps_epi32(pz);
+    __m512 corner[8];
+    for (int c = 0; c < 8; c++)
+    {
+      __m512i cx = _mm512_add_epi32(ix, _mm512_set1_epi32(c & 1));
+      __m512i cy = _mm512_add_epi32(iy, _mm512_set1_epi32(c >> 1 & 1));
+      __m512i cz = _mm512_add_epi32(iz, _mm512_set1_epi32(c >> 2 & 1));
+      __mmask16 inside = inRange512(cx, sizeX) & inRange512(cy, sizeY) & inRange512(cz, sizeZ);
+      __m512i index = _mm512_add_epi32(_mm512_add_epi32(_mm512_mullo_epi32(cz, strideZ), _mm512_mullo_epi32(cy, strideY)), cx);
+      corner[c] = _mm512_mask_i32gather_ps(outside, inside, index, grid, 4);
+    }
+    __m512 wx = _mm512_sub_ps(px, _mm512_cvtepi32_ps(ix));
+    __m512 wy = _mm512_sub_ps(py, _mm512_cvtepi32_ps(iy));
+    __m512 wz = _mm512_sub_ps(pz, _mm512_cvtepi32_ps(iz));
+    _mm512_storeu_ps(values + i, interpolateAvx512(corner, wx, wy, wz));
+  }
+  sampleScalarGridAvx2(grid, gridSize, outsideValue, x, y, z, i, end, values);
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+void sampleVectorGridAvx512(const float *grid, const Eigen::Vector3i &gridSize,
+                            const float *x, const float *y, const float *z, int begin, int end, float *values)
+{
+  const __m512i totalNumberOfVoxels = _mm512_set1_epi32(gridSize.prod());
+  const __m512i strideY = _mm512_set1_epi32(gridSize(0)), strideZ = _mm512_set1_epi32(gridSize(0) * gridSize(1));
+  int i = begin;
+  for (; i + 16 <= end; i += 16)
+  {
+    __m512 px = _mm512_loadu_ps(x + i), py = _mm512_loadu_ps(y + i), pz = _mm512_loadu_ps(z + i);
+    __m512i ix = _mm512_cvttps_epi32(px), iy = _mm512_cvttps_epi32(py), iz = _mm512_cvttps_epi32(pz);
+    __m512 corner[3][8];
+    for (int c = 0; c < 8; c++)
+    {
+      __m512i cx = _mm512_add_epi32(ix, _mm512_set1_epi32(c & 1));
+      __m512i cy = _mm512_add_epi32(iy, _mm512_set1_epi32(c >> 1 & 1));
+      __m512i cz = _mm512_add_epi32(iz, _mm512_set1_epi32(c >> 2 & 1));
+      __m512i index = _mm512_add_epi32(_mm512_add_epi32(_mm512_mullo_epi32(cz, strideZ), _mm512_mullo_epi32(cy, strideY)), cx);
+      __mmask16 mask = inRange512(index, totalNumberOfVoxels);
+      __m512i componentIndex = _mm512_mullo_epi32(index, _mm512_set1_epi32(3));
+      for (int k = 0; k < 3; k++)
+        corner[k][c] = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, componentIndex, grid + k, 4);
+    }
+    __m512 wx = _mm512_sub_ps(px, _mm512_cvtepi32_ps(ix));
+    __m512 wy = _mm512_sub_ps(py, _mm512_cvtepi32_ps(iy));
+    __m512 wz = _mm512_sub_ps(pz, _mm512_cvtepi32_ps(iz));
+    float component[3][16];
+    for (int k = 0; k < 3; k++)
+      _mm512_storeu_ps(component[k], interpolateAvx512(corner[k], wx, wy, wz));
+    for (int lane = 0; lane < 16; lane++)
+      for (int k = 0; k < 3; k++)
+        values[3 * (i + lane) + k] = component[k][lane];
+  }
+  sampleVectorGridAvx2(grid, gridSize, x, y, z, i, end, values);
+}
+#endif
+
+struct SamplerTable
+{
+  ScalarGridSampler<double> scalarGrid;
+  VectorGridSampler<double> vectorGrid;
+  ScalarGridSampler<float> scalarGridFloat;
+  VectorGridSampler<float> vectorGridFloat;
+  const char *instructionSet;
+};
+
+SamplerTable selectSamplers()
+{
+#ifdef TRILINEAR_SAMPLER_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return {sampleScalarGridAvx512, sampleVectorGridAvx512, sampleScalarGridAvx512, sampleVectorGridAvx512, "avx512"};
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return {sampleScalarGridAvx2, sampleVectorGridAvx2, sampleScalarGridAvx2, sampleVectorGridAvx2, "avx2"};
+#endif
+  return {sampleScalarGridScalar<double>, sampleVectorGridScalar<double>,
+          sampleScalarGridScalar<float>, sampleVectorGridScalar<float>, "scalar"};
+}
+
+// Picked once, on first use.
+const SamplerTable &getSamplers()
+{
+  static const SamplerTable samplers = selectSamplers();
+  return samplers;
+}
+} // namespace
+
+void TrilinearSampler::sampleScalarGrid(const double *grid,
+                                        const Eigen::Vector3i &gridSize,
+                                        double outsideValue,
+                                        const double *x,
+                                        const double *y,
+                                        const double *z,
+                                        int count,
+                                        double *values)
+{
+  getSamplers().scalarGrid(grid, gridSize, outsideValue, x, y, z, 0, count, values);
+}
+
+void TrilinearSampler::sampleVectorGrid(const Eigen::Vector3d *grid,
+                                        const Eigen::Vector3i &gridSize,
+                                        const double *x,
+                                        const double *y,
+                                        const double *z,
+                                        int count,
+                                        Eigen::Vector3d *values)
+{
+  getSamplers().vectorGrid(grid->data(), gridSize, x, y, z, 0, count, values->data());
+}
+
+void TrilinearSampler::sampleScalarGrid(const float *grid,
+                                        const Eigen::Vector3i &gridSize,
+                                        float outsideValue,
+                                        const float *x,
+                                        const float *y,
+                                        const float *z,
+                                        int count,
+                                        float *values)
+{
+  getSamplers().scalarGridFloat(grid, gridSize, outsideValue, x, y, z, 0, count, values);
+}
+
+void TrilinearSampler::sampleVectorGrid(const Eigen::Vector3f *grid,
+                                        const Eigen::Vector3i &gridSize,
+                                        const float *x,
+                                        const float *y,
+                                        const float *z,
+                                        int count,
+                                        Eigen::Vector3f *values)
+{
+  getSamplers().vectorGridFloat(grid->data(), gridSize, x, y, z, 0, count, values->data());
+}
+
+const char *TrilinearSampler::getInstructionSet()
+{
+  return getSamplers().instructionSet;
+}
+
+void TrilinearSampler::testSampleGrids()
+{
+  // SIMD batches must match interpolate3D, also for corners outside the grid. FMA changes only the last bits.
+  const Eigen::Vector3i gridSize(5, 4, 3);
+  const int totalNumberOfVoxels = gridSize.prod();
+  std::vector<double> scalarGrid(totalNumberOfVoxels);
+  std::vector<Eigen::Vector3d> vectorGrid(totalNumberOfVoxels);
+  for (int i = 0; i < totalNumberOfVoxels; i++)
+  {
+    scalarGrid[i] = i * 0.25 - 3;
+    vectorGrid[i] = Eigen::Vector3d(i, -0.5 * i, i % 7);
+  }
+
+  const int count = 23; // Not a multiple of the batch size, to also run the scalar tail.
+  double x[count], y[count], z[count], scalarValues[count], expectedScalarValues[count];
+  Eigen::Vector3d vectorValues[count], expectedVectorValues[count];
+  srand(7);
+  for (int i = 0; i < count; i++)
+  {
+    x[i] = rand() / double(RAND_MAX) * (gridSize(0) + 1) - 1;
+    y[i] = rand() / double(RAND_MAX) * (gridSize(1) + 1) - 1;
+    z[i] = rand() / double(RAND_MAX) * (gridSize(2) + 1) - 1;
+  }
+
+  sampleScalarGrid(scalarGrid.data(), gridSize, MaxSurfaceVoxelDistance, x, y, z, count, scalarValues);
+  sampleVectorGrid(vectorGrid.data(), gridSize, x, y, z, count, vectorValues);
+  sampleScalarGridScalar(scalarGrid.data(), gridSize, MaxSurfaceVoxelDistance, x, y, z, 0, count, expectedScalarValues);
+  sampleVectorGridScalar(vectorGrid.data()->data(), gridSize, x, y, z, 0, count, expectedVectorValues->data());
+  for (int i = 0; i < count; i++)
+  {
+    assert(fabs(scalarValues[i] - expectedScalarValues[i]) < 1e-9 && "Whoops! Check TrilinearSampler::sampleScalarGrid");
+    assert((vectorValues[i] - expectedVectorValues[i]).norm() < 1e-9 && "Whoops! Check TrilinearSampler::sampleVectorGrid");
+  }
+
+  // Same points in float, against the double values.
+  std::vector<float> scalarGridFloat(scalarGrid.begin(), scalarGrid.end());
+  std::vector<Eigen::Vector3f> vectorGridFloat(totalNumberOfVoxels);
+  float xFloat[count], yFloat[count], zFloat[count], scalarValuesFloat[count];
+  Eigen::Vector3f vectorValuesFloat[count];
+  for (int i = 0; i < totalNumberOfVoxels; i++)
+    vectorGridFloat[i] = vectorGrid[i].cast<float>();
+  for (int i = 0; i < count; i++)
+  {
+    xFloat[i] = float(x[i]);
+    yFloat[i] = float(y[i]);
+    zFloat[i] = float(z[i]);
+  }
+  sampleScalarGrid(scalarGridFloat.data(), gridSize, float(MaxSurfaceVoxelDistance), xFloat, yFloat, zFloat, count, scalarValuesFloat);
+  sampleVectorGrid(vectorGridFloat.data(), gridSize, xFloat, yFloat, zFloat, count, vectorValuesFloat);
+  for (int i = 0; i < count; i++)
+  {
+    assert(fabs(scalarValuesFloat[i] - expectedScalarValues[i]) < 1e-4 && "Whoops! Check TrilinearSampler::sampleScalarGrid in float");
+    assert((vectorValuesFloat[i].cast<double>() - expectedVectorValues[i]).norm() < 1e-4 && "Whoops! Check TrilinearSampler::sampleVectorGrid in float");
+  }
+  cout << "TrilinearSampler uses " << getInstructionSet() << endl;
+}
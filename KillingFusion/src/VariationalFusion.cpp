@@ -0,0 +1,452 @@
+//
+// Created by Saurabh Khanduja on 22.10.18.
+//
+
+#include "VariationalFusion.h"
+#include "KillingFusion.h"
+#include "SobolevFusion.h"
+#include "SDF.h"
+#include "FiniteDifferences.h"
+#include "Timer.h"
+using namespace std;
+
+VariationalFusion::VariationalFusion(DatasetReader datasetReader)
+    : m_datasetReader(datasetReader),
+      m_canonicalSdf(nullptr),
+      m_prevSdf(nullptr)
+{
+  // Create a canonical SDF
+  int w = m_datasetReader.getDepthWidth();
+  int h = m_datasetReader.getDepthHeight();
+  double minDepth = m_datasetReader.getMinimumDepthThreshold();
+  double maxDepth = m_datasetReader.getMaximumDepthThreshold();
+  std::pair<Eigen::Vector3d, Eigen::Vector3d> frameBound = computeBounds(w, h, minDepth, maxDepth);
+  m_canonicalSdf = new SDF(VoxelSize,
+                           frameBound.first,
+                           frameBound.second,
+                           UnknownClipDistance);
+  cout << "Grid Size:" << m_canonicalSdf->getGridSize().transpose() << endl;
+  m_startFrame = 1;
+  m_endFrame = 99;
+  m_stride = 1;
+  m_currFrameIndex = m_startFrame;
+  m_prev2CanDisplacementField = nullptr;
+}
+
+VariationalFusion *VariationalFusion::create(DatasetReader datasetReader)
+{
+  switch (fusionTechnique)
+  {
+  case SOBOLEV_FUSION:
+    return new SobolevFusion(datasetReader);
+  case KILLING_FUSION:
+  default:
+    return new KillingFusion(datasetReader);
+  }
+}
+
+VariationalFusion::~VariationalFusion()
+
+{
+  // ToDo - Use Unique Ptr
+  if (m_canonicalSdf != nullptr)
+    delete m_canonicalSdf;
+  if (m_prev2CanDisplacementField != nullptr)
+    delete m_prev2CanDisplacementField;
+  if (m_prevSdf != nullptr)
+    delete m_prevSdf;
+  for (DisplacementField *displacementField : m_displacementFieldHistory)
+    delete displacementField;
+}
+
+void VariationalFusion::process()
+{
+  // Set the sequence of image to process
+  // int startFrame = 0;
+  int startFrame = 4;
+  int endFrame = 100;
+  // int endFrame = m_datasetReader.getNumImageFiles();
+
+  // Set canonical SDF to SDF of first frame
+  SDF *firstSdf = computeSDF(startFrame);
+  startRegistration(*firstSdf);
+  m_canonicalSdf->fuse(firstSdf);
+
+  // Save Mesh of the SDF
+  string meshFileNames[4] = {"InputFrameSDF", "RegisteredFrameSDF", "CanonicalSDF", "LiveCanonicalSdf"};
+  firstSdf->save_mesh(meshFileNames[0], startFrame);
+  firstSdf->save_mesh(meshFileNames[1], startFrame);
+  firstSdf->save_mesh(meshFileNames[2], startFrame);
+  firstSdf->save_mesh(meshFileNames[3], startFrame);
+  delete firstSdf;
+
+  Timer totalTimer, timer;
+  cout << "Frame  Compute SDF    KillingOptimize    Fuse SDF\n";
+  // For each image file from DatasetReader
+  for (int i = startFrame + 1; i < endFrame; ++i)
+  {
+    // Convert current frame to SDF - currSdf
+    timer.reset();
+    SDF *currSdf = computeSDF(i);
+    double sdfTime = timer.elapsed();
+    // Save SDF of Current Frame
+    currSdf->save_mesh(meshFileNames[0], i);
+
+    // Compute Deformation Field for current frame SDF to merge with m_canonicalSdf, starting from the field of
+    // previous frame.
+    timer.reset();
+    DisplacementField *curr2CanDisplacementField = registerFrame(currSdf, true);
+    double killingTime = timer.elapsed();
+
+    // Save Registered SDF Current Frame
+    currSdf->save_mesh(meshFileNames[1], i, *curr2CanDisplacementField);
+
+    // Merge the m_currSdf to m_canonicalSdf using m_currSdf displacement field.
+    timer.reset();
+    m_canonicalSdf->fuse(currSdf, curr2CanDisplacementField);
+    double fuseTime = timer.elapsed();
+
+    // Save Canonical SDF
+    m_canonicalSdf->save_mesh(meshFileNames[2], i);
+
+    // Save Live Canonical SDF registered towards CurrentFrame
+    SDF *liveCanonicalSdf = computeLiveCanonicalSdf(*curr2CanDisplacementField);
+    liveCanonicalSdf->save_mesh(meshFileNames[3], i);
+    delete liveCanonicalSdf;
+
+    finishFrame(currSdf, curr2CanDisplacementField);
+    printf("%03d\t%0.6fs\t%0.6fs\t%0.6fs\n", i, sdfTime, killingTime, fuseTime);
+  }
+  cout << "Total time spent " << totalTimer.elapsed() << endl;
+  m_canonicalSdf->dumpToBinFile("FinalCanonicalModel.bin",
+                                UnknownClipDistance, 1.0);
+}
+
+vector<SimpleMesh *> VariationalFusion::processNextFrame()
+{
+  vector<SimpleMesh *> meshes;
+
+  SimpleMesh *canonicalMesh = nullptr, *currentSdfMesh = nullptr, *currentFrameRegisteredSdfMesh = nullptr;
+
+  if (m_currFrameIndex == m_startFrame)
+  {
+    m_canonicalSdf = computeSDF(m_startFrame);
+    startRegistration(*m_canonicalSdf);
+    currentSdfMesh = UseSurfaceNets ? m_canonicalSdf->getSurfaceNetsMesh() : m_canonicalSdf->getMesh();
+    currentFrameRegisteredSdfMesh = UseSurfaceNets ? m_canonicalSdf->getSurfaceNetsMesh(*m_prev2CanDisplacementField)
+                                                   : m_canonicalSdf->getMesh(*m_prev2CanDisplacementField);
+    m_currFrameIndex += m_stride;
+  }
+  else if (m_currFrameIndex < m_endFrame)
+  {
+    Timer totalTimer, timer;
+    totalTimer.reset();
+    cout << "Frame  Compute SDF    KillingOptimize    Fuse SDF    Total Time\n";
+    timer.reset();
+    // Convert current frame to SDF - currSdf
+    SDF *currSdf = computeSDF(m_currFrameIndex);
+    double sdfTime = timer.elapsed();
+
+    timer.reset();
+    // Compute Deformation Field for current frame SDF to merge with m_canonicalSdf
+    DisplacementField *curr2CanDisplacementField = registerFrame(currSdf, false);
+    if (EnergyTypeUsed[0] || EnergyTypeUsed[1] || EnergyTypeUsed[2])
+    {
+      std::stringstream filenameStream;
+      filenameStream << OUTPUT_DIR << outputDir[datasetType] << std::setfill('0') << std::setw(3) << std::to_string(m_currFrameIndex) << ".bin";
+      curr2CanDisplacementField->dumpToBinFile(filenameStream.str());
+    }
+    double killingTime = timer.elapsed();
+
+    timer.reset();
+    // Merge the m_currSdf to m_canonicalSdf using m_currSdf displacement field.
+    currentSdfMesh = UseSurfaceNets ? currSdf->getSurfaceNetsMesh() : currSdf->getMesh();
+    // Warp and merge in one pass. currSdf stays unwarped, as it is the registration target of next frame in
+    // UseFrameToFrameRegistration mode.
+    m_canonicalSdf->fuse(currSdf, curr2CanDisplacementField);
+    currentFrameRegisteredSdfMesh = UseSurfaceNets ? currSdf->getSurfaceNetsMesh(*curr2CanDisplacementField)
+                                                   : currSdf->getMesh(*curr2CanDisplacementField);
+    double fuseTime = timer.elapsed();
+
+    finishFrame(currSdf, curr2CanDisplacementField);
+    double totalTime = totalTimer.elapsed();
+    printf("%03d\t%0.6fs\t%0.6fs\t%0.6fs\t%0.6fs\n", m_currFrameIndex, sdfTime, killingTime, fuseTime, totalTime);
+    m_currFrameIndex += m_stride;
+  }
+  canonicalMesh = UseSurfaceNets ? m_canonicalSdf->getSurfaceNetsMesh() : m_canonicalSdf->getCachedMesh();
+  meshes.push_back(currentSdfMesh);
+  meshes.push_back(currentFrameRegisteredSdfMesh);
+  meshes.push_back(canonicalMesh);
+  return meshes;
+}
+
+void VariationalFusion::startRegistration(const SDF &firstSdf)
+{
+  m_prev2CanDisplacementField = createZeroDisplacementField(firstSdf);
+  if (!UseZeroDisplacementFieldForNextFrame)
+    pushDisplacementFieldHistory(*m_prev2CanDisplacementField);
+  if (UseFrameToFrameRegistration)
+    m_prevSdf = new SDF(firstSdf);
+}
+
+DisplacementField *VariationalFusion::registerFrame(const SDF *currSdf, bool reusePreviousField)
+{
+  // Future Task - Implement SDF-2-SDF to register currSDF to prevSDF
+  // Future Task - ToDo - DisplacementField should have same shape as their SDF, thus should be generated by SDF object
+  DisplacementField *curr2CanDisplacementField;
+  if (UseFrameToFrameRegistration || (UseZeroDisplacementFieldForNextFrame && reusePreviousField))
+    curr2CanDisplacementField = new DisplacementField(*m_prev2CanDisplacementField);
+  else if (UseZeroDisplacementFieldForNextFrame)
+    curr2CanDisplacementField = createZeroDisplacementField(*currSdf);
+  else
+    curr2CanDisplacementField = predictDisplacementField();
+  delete m_prev2CanDisplacementField;
+  m_prev2CanDisplacementField = nullptr;
+
+  if (!(EnergyTypeUsed[0] || EnergyTypeUsed[1] || EnergyTypeUsed[2])) // For quick check on what happens if no energy is used.
+    return curr2CanDisplacementField;
+  if (UseFrameToFrameRegistration)
+  {
+    // Motion between two frames is small, thus currSdf is registered to previous frame starting from zero,
+    // and the result is composed after previous to canonical field.
+    DisplacementField *curr2PrevDisplacementField = createZeroDisplacementField(*currSdf);
+    computeDisplacementField(currSdf, m_prevSdf, curr2PrevDisplacementField);
+    curr2CanDisplacementField->compose(*curr2PrevDisplacementField);
+    delete curr2PrevDisplacementField;
+  }
+  else
+    computeDisplacementField(currSdf, m_canonicalSdf, curr2CanDisplacementField);
+  return curr2CanDisplacementField;
+}
+
+void VariationalFusion::finishFrame(SDF *currSdf, DisplacementField *curr2CanDisplacementField)
+{
+  m_prev2CanDisplacementField = curr2CanDisplacementField;
+  if (!UseZeroDisplacementFieldForNextFrame)
+    pushDisplacementFieldHistory(*m_prev2CanDisplacementField);
+  if (UseFrameToFrameRegistration)
+  {
+    delete m_prevSdf;
+    if (UseLiveCanonicalTarget)
+    {
+      m_prevSdf = computeLiveCanonicalSdf(*curr2CanDisplacementField);
+      delete currSdf;
+    }
+    else
+      m_prevSdf = currSdf;
+  }
+  else
+    delete currSdf;
+}
+
+void VariationalFusion::processTest(int testType)
+{
+  // Set prevSdf to SDF of first frame
+  vector<SDF> adjacentVoxelSDFs = SDF::getDataEnergyTestSample(VoxelSize, UnknownClipDistance);
+  DisplacementField *next2CanDisplacementField = createZeroDisplacementField(adjacentVoxelSDFs[1]);
+  if (testType == 1)
+  { // Test if fuse works when merging one SDF to itself
+    adjacentVoxelSDFs[0].dumpToBinFile("testType-1-outputSphere0.bin", UnknownClipDistance, 1.0f);
+    adjacentVoxelSDFs[1].dumpToBinFile("testType-1-outputSphere1.bin", UnknownClipDistance, 1.0f);
+    adjacentVoxelSDFs[0].fuse(&(adjacentVoxelSDFs[0]));
+    adjacentVoxelSDFs[0].dumpToBinFile("testType-1-outputSphere0MergedTo0.bin", UnknownClipDistance, 1.0f);
+  }
+  else if (testType == 2)
+  { // Test if fuse works when merging one SDF to another
+    adjacentVoxelSDFs[0].dumpToBinFile("testType-1-outputSphere0.bin", UnknownClipDistance, 1.0f);
+    adjacentVoxelSDFs[1].dumpToBinFile("testType-1-outputSphere1.bin", UnknownClipDistance, 1.0f);
+    adjacentVoxelSDFs[0].fuse(&(adjacentVoxelSDFs[1]));
+    adjacentVoxelSDFs[0].dumpToBinFile("testType-1-outputSphere1MergedTo0.bin", UnknownClipDistance, 1.0f);
+  }
+  else
+  {
+    computeDisplacementField(&(adjacentVoxelSDFs[1]), &(adjacentVoxelSDFs[0]), next2CanDisplacementField);
+    adjacentVoxelSDFs[0].fuse(&(adjacentVoxelSDFs[1]), next2CanDisplacementField);
+    SDF srcCopy(adjacentVoxelSDFs[1]);
+    srcCopy.fuse(&(adjacentVoxelSDFs[1]), next2CanDisplacementField);
+    srcCopy.dumpToBinFile("testType-2-outputSphere1Deformed.bin", UnknownClipDistance, 1.0f);
+    adjacentVoxelSDFs[0].dumpToBinFile("testType-2-outputSphere1MergedTo0UsingKilling.bin", UnknownClipDistance, 1.0f);
+  }
+
+  delete next2CanDisplacementField;
+}
+
+// SDF λ˾ǵλµSDFϵ½
+// ԭгģGiven a new depth frame Dn, we register it
+// Ϊû׼ҲǵºcomputeDisplacementField޷һҪԭ򡣵ȫ
+// to the previous one and obtain an estimate of its pose relative to the global model.
+SDF *VariationalFusion::computeSDF(int frameIndex)
+{
+  // ToDo: SDF class should compute itself
+  // This will cause issue. SDF of Different Frames will be of different size.
+  // This will cause deformation field to be of different size.
+  // You then cannot simply set curr2PrevDisplacementField = prev2CanDisplacementField
+  int w = m_datasetReader.getDepthWidth();
+  int h = m_datasetReader.getDepthHeight();
+  double minDepth = m_datasetReader.getMinimumDepthThreshold();
+  double maxDepth = m_datasetReader.getMaximumDepthThreshold();
+  std::pair<Eigen::Vector3d, Eigen::Vector3d> frameBound = computeBounds(w, h, minDepth, maxDepth);
+  SDF *sdf = new SDF(VoxelSize,
+                     frameBound.first,
+                     frameBound.second,
+                     UnknownClipDistance);
+  std::vector<cv::Mat> cdoImages = m_datasetReader.getImages(frameIndex);
+  sdf->integrateDepthFrame(cdoImages.at(1),
+                           Eigen::Matrix4d::Identity(),
+                           m_datasetReader.getDepthIntrinsicMatrix(),
+                           minDepth,
+                           maxDepth);
+  return sdf;
+}
+
+DisplacementField *VariationalFusion::createZeroDisplacementField(const SDF &sdf)
+{
+  DisplacementField *displacementField = new DisplacementField(sdf.getGridSize(), VoxelSize);
+  // displacementField->initializeAllVoxels(Eigen::Vector3d(-m_currFrameIndex/5, 0, 0)); // To check if deformation field works. It does.
+  return displacementField;
+}
+
+DisplacementField *VariationalFusion::predictDisplacementField() const
+{
+  vector<const DisplacementField *> fields(m_displacementFieldHistory.begin(), m_displacementFieldHistory.end());
+  vector<double> weights;
+  if (fields.size() >= 3)
+  {
+    // Slope of least squares line through 3 frames is (f0 - f2) / 2, f1 does not contribute.
+    fields.resize(3);
+    weights = {1 + warmStartDamping / 2, 0, -warmStartDamping / 2};
+  }
+  else if (fields.size() == 2)
+    weights = {1 + warmStartDamping, -warmStartDamping};
+  else
+    weights = {1};
+
+  DisplacementField *prediction = new DisplacementField(fields[0]->getGridSize(), VoxelSize);
+  prediction->assignLinearCombination(fields, weights);
+  return prediction;
+}
+
+void VariationalFusion::pushDisplacementFieldHistory(const DisplacementField &curr2CanDisplacementField)
+{
+  m_displacementFieldHistory.push_front(new DisplacementField(curr2CanDisplacementField));
+  while (int(m_displacementFieldHistory.size()) > max(WARM_START_HISTORY, 1))
+  {
+    delete m_displacementFieldHistory.back();
+    m_displacementFieldHistory.pop_back();
+  }
+}
+
+SDF *VariationalFusion::computeLiveCanonicalSdf(const DisplacementField &curr2CanDisplacementField) const
+{
+  // curr2CanDisplacementField moves canonical voxels to where they are seen in current frame, so the inverse moves
+  // current frame voxels back to canonical SDF.
+  DisplacementField can2CurrDisplacementField(curr2CanDisplacementField);
+  curr2CanDisplacementField.invert(&can2CurrDisplacementField);
+  SDF *liveCanonicalSdf = new SDF(*m_canonicalSdf);
+  liveCanonicalSdf->fuse(m_canonicalSdf, &can2CurrDisplacementField);
+  return liveCanonicalSdf;
+}
+
+Eigen::Vector3d VariationalFusion::computeDataEnergyGradient(const SDF *src,
+                                                             const SDF *dest,
+                                                             const DisplacementField *srcDisplacementField,
+                                                             const Eigen::Vector3i &spatialIndex)
+{
+  Eigen::Vector3d srcPointDistanceGradient = src->computeDistanceGradient(spatialIndex, srcDisplacementField);
+  // if (srcPointDistanceGradient.norm() > 1e-3) // Do not normalize when near 0
+  //   srcPointDistanceGradient.normalize(); // only direction is required
+  double srcPointDistance = src->getDistance(spatialIndex, srcDisplacementField);
+  double destPointDistance = dest->getDistanceAtIndex(spatialIndex);
+  // computeDistanceGradient ֵķĸΪλ(Ϊ˱ĸС)ʵʾ Ҫʵʾ
+  return (srcPointDistance - destPointDistance) / VoxelSize * srcPointDistanceGradient.array();
+}
+
+Eigen::Vector3d VariationalFusion::computeLevelSetEnergyGradient(const SDF *src,
+                                                                 const SDF *dest,
+                                                                 const DisplacementField *srcDisplacementField,
+                                                                 const Eigen::Vector3i &spatialIndex)
+{
+  // Compute distance gradient
+  Eigen::Vector3d grad = src->computeDistanceGradient(spatialIndex, srcDisplacementField);
+
+  // Compute Hessian
+  Eigen::Matrix3d hessian = src->computeDistanceHessian(spatialIndex, srcDisplacementField);
+  // ﺣɭ͵ǻصԪ󵼵ģûл㵽ʵλˣ ΪӰ첻
+  Eigen::Vector3d levelSetGrad = hessian * grad * (grad.norm() - 1) / (grad.norm() + epsilon);
+  return levelSetGrad;
+}
+
+void VariationalFusion::computeDataAndLevelSetEnergyGradient(const SDF *src,
+                                                             const SDF *dest,
+                                                             const DisplacementField *srcDisplacementField,
+                                                             const Eigen::Vector3i &spatialIndex,
+                                                             double srcPointDistance,
+                                                             bool useDataEnergy,
+                                                             bool useLevelSetEnergy,
+                                                             Eigen::Vector3d &dataGradient,
+                                                             Eigen::Vector3d &levelSetGradient)
+{
+  dataGradient.setZero();
+  levelSetGradient.setZero();
+  if (!useDataEnergy && !useLevelSetEnergy)
+    return;
+
+  Eigen::Vector3d grad;
+  Eigen::Matrix3d hessian;
+  if (useLevelSetEnergy)
+    src->computeDistanceGradientAndHessian(spatialIndex, srcDisplacementField, grad, hessian);
+  else
+    grad = src->computeDistanceGradient(spatialIndex, srcDisplacementField);
+
+  if (useDataEnergy)
+  {
+    double destPointDistance = dest->getDistanceAtIndex(spatialIndex);
+    dataGradient = (srcPointDistance - destPointDistance) / VoxelSize * grad.array();
+  }
+  if (useLevelSetEnergy)
+    levelSetGradient = FiniteDifferences<double>::levelSetEnergyGradient(grad, hessian) * omegaLevelSet;
+}
+
+// ӳƽͷ׶߽
+std::pair<Eigen::Vector3d, Eigen::Vector3d> VariationalFusion::computeBounds(int w, int h, double minDepth, double maxDepth)
+{
+  // Create frustum for the camera
+  Eigen::MatrixXd cornerPoints;
+  cornerPoints.resize(3, 8);
+  cornerPoints << 0, 0, w - 1, w - 1, 0, 0, w - 1, w - 1,
+                  0, h - 1, h - 1, 0, 0, h - 1, h - 1, 0,
+                  1, 1, 1, 1, 1, 1, 1, 1;
+
+  Eigen::Matrix<double, 1, 8> cornersDepth;
+  cornersDepth << minDepth, minDepth, minDepth, minDepth,
+      maxDepth, maxDepth, maxDepth, maxDepth;
+
+  // Compute depthIntrinsicMatrix
+  Eigen::Matrix3d depthIntrinsicMatrix = m_datasetReader.getDepthIntrinsicMatrix();
+  Eigen::Matrix3d depthIntrinsicMatrixInv = depthIntrinsicMatrix.inverse();
+
+  // Compute the corner location in the Camera Coordinate System(CCS)
+  Eigen::MatrixXd imagePoints = depthIntrinsicMatrixInv * cornerPoints;
+
+  // Compute the frustum in the Camera Coordinate System(CCS)
+  imagePoints.conservativeResize(4, 8); // Resize from 3x8 to 4x8
+  imagePoints.topLeftCorner(2, 4) =      // ӱ߽ǿʼȡӾ
+      imagePoints.topLeftCorner(2, 4) * minDepth; // Multiply front four corners with minDepth
+  imagePoints.topRightCorner(2, 4) =
+      imagePoints.topRightCorner(2, 4) * maxDepth; // Multiply back four corners with maxDepth
+  imagePoints.row(3) = imagePoints.row(2);         // Move ones below
+  imagePoints.row(2) = cornersDepth.transpose();   // Replace 3rd row with min/max depth values
+
+  // Compute world location of this frustum
+  // Since world is same as camera, is Eigen::Matrix4d::Identity()
+  Eigen::Matrix4d camera_to_world_pose = Eigen::Matrix4d::Identity();
+  Eigen::Matrix<double, 4, 8> frustumWorldPoints = camera_to_world_pose * imagePoints;
+  // Compute the bounds of parallelogram containing the frustum
+  Eigen::Vector4d minXYZ = frustumWorldPoints.rowwise().minCoeff().array();
+  Eigen::Vector4d maxXYZ = frustumWorldPoints.rowwise().maxCoeff().array();
+
+  Eigen::Vector3d min3dLoc(minXYZ(0), minXYZ(1), minXYZ(2));
+  Eigen::Vector3d max3dLoc(maxXYZ(0), maxXYZ(1), maxXYZ(2));
+
+  return pair<Eigen::Vector3d, Eigen::Vector3d>(min3dLoc, max3dLoc);
+}
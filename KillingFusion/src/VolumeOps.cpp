@@ -0,0 +1,158 @@
+#include "VolumeOps.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <vector>
+#include "config.h"
+using namespace std;
+
+void VolumeOps::fill(double *values, int count, double value)
+{
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for simd schedule(static)
+#endif
+  for (int i = 0; i < count; i++)
+    values[i] = value;
+}
+
+void VolumeOps::fill(short *values, int count, short value)
+{
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for simd schedule(static)
+#endif
+  for (int i = 0; i < count; i++)
+    values[i] = value;
+}
+
+void VolumeOps::fill(Eigen::Vector3d *values, int count, const Eigen::Vector3d &value)
+{
+  double *components = values->data();
+  const double x = value(0), y = value(1), z = value(2);
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for simd schedule(static)
+#endif
+  for (int i = 0; i < count; i++)
+  {
+    components[3 * i] = x;
+    components[3 * i + 1] = y;
+    components[3 * i + 2] = z;
+  }
+}
+
+void VolumeOps::axpy(double alpha, const double *x, double *y, int count)
+{
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for simd schedule(static)
+#endif
+  for (int i = 0; i < count; i++)
+    y[i] += alpha * x[i];
+}
+
+void VolumeOps::blend(double alpha, const double *x, double beta, const double *y, double *out, int count)
+{
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for simd schedule(static)
+#endif
+  for (int i = 0; i < count; i++)
+    out[i] = alpha * x[i] + beta * y[i];
+}
+
+void VolumeOps::mergeWeighted(double *distance,
+                              short *weight,
+                              const double *otherDistance,
+                              const short *otherWeight,
+                              int count,
+                              int maxWeight,
+                              double saturatedTolerance)
+{
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for simd schedule(static)
+#endif
+  for (int i = 0; i < count; i++)
+  {
+    int w1 = weight[i], w2 = otherWeight[i];
+    double dist1 = distance[i], dist2 = otherDistance[i];
+    bool keep = w2 == 0 || (w1 >= maxWeight && fabs(dist1 - dist2) <= saturatedTolerance);
+    double merged = w1 == 0 ? dist2 : (w1 * dist1 + w2 * dist2) / (w1 + w2);
+    distance[i] = keep ? dist1 : merged;
+    weight[i] = short(keep ? w1 : min(w1 + w2, maxWeight));
+  }
+}
+
+void VolumeOps::minMax(const double *values, int count, double &minValue, double &maxValue)
+{
+  double minimum = values[0], maximum = values[0];
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for simd schedule(static) reduction(min : minimum) reduction(max : maximum)
+#endif
+  for (int i = 0; i < count; i++)
+  {
+    minimum = min(minimum, values[i]);
+    maximum = max(maximum, values[i]);
+  }
+  minValue = minimum;
+  maxValue = maximum;
+}
+
+void VolumeOps::normRange(const Eigen::Vector3d *values, int count, double &minNorm, double &maxNorm)
+{
+  const double *components = values->data();
+  // Reduce squared norms, so that only the two results need a square root.
+  double minimum = INFINITY, maximum = 0;
+#ifndef DISABLE_OPENMP
+#pragma omp parallel for simd schedule(static) reduction(min : minimum) reduction(max : maximum)
+#endif
+  for (int i = 0; i < count; i++)
+  {
+    double x = components[3 * i], y = components[3 * i + 1], z = components[3 * i + 2];
+    double squaredNorm = x * x + y * y + z * z;
+    minimum = min(minimum, squaredNorm);
+    maximum = max(maximum, squaredNorm);
+  }
+  minNorm = sqrt(minimum);
+  maxNorm = sqrt(maximum);
+}
+
+void VolumeOps::testVolumeOps()
+{
+  // Odd count, so that the passes also run their remainder after the last full SIMD register.
+  const int count = 1003;
+  vector<double> x(count), y(count), out(count);
+  for (int i = 0; i < count; i++)
+  {
+    x[i] = sin(i);
+    y[i] = cos(i);
+  }
+
+  blend(2, x.data(), -1, y.data(), out.data(), count);
+  axpy(0.5, x.data(), y.data(), count);
+  for (int i = 0; i < count; i++)
+  {
+    assert(fabs(out[i] - (2 * sin(i) - cos(i))) < epsilon && "Whoops, check VolumeOps::blend");
+    assert(fabs(y[i] - (cos(i) + 0.5 * sin(i))) < epsilon && "Whoops, check VolumeOps::axpy");
+  }
+
+  double minValue, maxValue;
+  minMax(x.data(), count, minValue, maxValue);
+  assert(minValue == *min_element(x.begin(), x.end()) && maxValue == *max_element(x.begin(), x.end()) &&
+         "Whoops, check VolumeOps::minMax");
+
+  vector<Eigen::Vector3d> vectors(count);
+  fill(vectors.data(), count, Eigen::Vector3d(1, 2, 2));
+  vectors[7] = Eigen::Vector3d(0, 0, 1);
+  vectors[11] = Eigen::Vector3d(0, 6, 8);
+  double minNorm, maxNorm;
+  normRange(vectors.data(), count, minNorm, maxNorm);
+  assert(vectors[count - 1] == Eigen::Vector3d(1, 2, 2) && "Whoops, check VolumeOps::fill");
+  assert(minNorm == 1 && maxNorm == 10 && "Whoops, check VolumeOps::normRange");
+
+  // Empty, fused, saturated and agreeing, saturated and disagreeing, and a voxel not seen by the other volume.
+  double distance[5] = {0, 1, 1, 1, 1}, otherDistance[5] = {2, 3, 1.05, 3, 3};
+  short weight[5] = {0, 1, 8, 8, 3}, otherWeight[5] = {2, 1, 2, 2, 0};
+  mergeWeighted(distance, weight, otherDistance, otherWeight, 5, 8, 0.1);
+  double expectedDistance[5] = {2, 2, 1, 1.4, 1};
+  short expectedWeight[5] = {2, 2, 8, 8, 3};
+  for (int i = 0; i < 5; i++)
+    assert(fabs(distance[i] - expectedDistance[i]) < epsilon && weight[i] == expectedWeight[i] &&
+           "Whoops, check VolumeOps::mergeWeighted");
+}
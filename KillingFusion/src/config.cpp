@@ -6,6 +6,10 @@ const double VoxelSize = 0.012;
 const double UnknownClipDistance = VoxelSize * 4;
 const double MaxSurfaceVoxelDistance = VoxelSize * 4;
 const bool FUSE_BY_MERGE = true;
+const int MAX_FUSION_WEIGHT = 64;
+const double saturatedFuseTolerance = VoxelSize / 100;
+const int MESH_BRICK_SIZE = 16;
+const bool UseSurfaceNets = false;
 
 // Dataset and Pipeline to Use
 //目录设置
@@ -27,9 +31,40 @@ const std::string outputDir[2] = {"Duck/", "Snoopy/"};
 
 const bool EnergyTypeUsed[3] = {true, true, true}; // Data, LevelSet, Killing
 const bool UseZeroDisplacementFieldForNextFrame = true;
+const int WARM_START_HISTORY = 3;
+const double warmStartDamping = 0.5;
+const bool UseFrameToFrameRegistration = false;
+const bool UseLiveCanonicalTarget = false;
+const int FIELD_INVERSION_ITERATIONS = 20;
+const double fieldInversionTolerance = 1e-3;
 const bool UpdateAllVoxelsInEachIter = true; //原作者设置的是false为了加快计算，但计算原理是不对的
-const bool UsePreviousIterationDeformationField = true; // If true, previous iteration displacement field is used for computing LevelSet Energy and KillingEnergy. 
+const bool UsePreviousIterationDeformationField = false; // If true, previous iteration displacement field is used for computing LevelSet Energy and KillingEnergy. If false, field is updated in place by a Gauss-Seidel sweep over 8 colors.
+const bool UseActiveSet = true;
+const double activeSetThreshold = 0.01 / 1000; // A tenth of maxUpdateThreshold, so that frozen voxels barely change the result.
+const int TILE_SIZE = 8;
+const bool UseResidualBricks = false;
+const int RESIDUAL_BRICK_SIZE = 8;
+const int RESIDUAL_BRICK_HALO = 2;
+const double residualBrickThreshold = 0.1;
+const bool UseControlLattice = false;
+const int CONTROL_LATTICE_SPACING = 4;
+#ifdef SINGLE_PRECISION_KERNELS
+const bool UseSinglePrecision = true;
+#else
+const bool UseSinglePrecision = false;
+#endif
+const double maxUpdateThreshold = 0.1 / 1000; // Registration is terminated when the magnitude of the maximum vector update falls below 0.1 mm.
+const double updateQuantile = 0;
+const double minRelativeEnergyDecrease = 0;
+const double registrationTimeBudget = 0;
+const bool PrintEnergyEachIteration = false;
+
 const bool UseTrustStrategy = false; // Only used when working only with data energy. Helps in finding which alpha to use for voxel data energy gradient.
+const bool UseAdaptiveStepSize = false;
+const double adaptiveAlpha = 0.005;
+const double adaptiveBeta1 = 0.9;
+const double adaptiveBeta2 = 0.999;
+const double adaptiveEpsilon = 1e-8;
 // Do not reduce, causes floating point precision errors in SDF::computeDistanceHessian
 const double deltaSize = 0.05; // Step Size in Voxel unit for central difference.
 
@@ -47,6 +82,17 @@ const double deltaSize = 0.05; // Step Size in Voxel unit for central difference
 const int KILLING_MAX_ITERATIONS = 50;// 1024;
 const double threshold = 0.000001;
 
+const bool UseGaussNewton = false;
+const int GAUSS_NEWTON_MAX_ITERATIONS = 5;
+const int CG_MAX_ITERATIONS = 30;
+const double cgTolerance = 0.01;
+const double levenbergDamping = 0.01;
+
+const int SOBOLEV_KERNEL_SIZE = 7;
+const double sobolevLambda = 0.1;
+
+
+
 const double alpha = 0.025;
 
 // Killing weights
@@ -3,22 +3,40 @@
 //
 #include <string>
 
-#include "KillingFusion.h"
+#include "VariationalFusion.h"
+
 #include "DatasetReader.h"
+#include "TrilinearSampler.h"
+#include "ControlLattice.h"
+#include "VolumeOps.h"
+#include "AdaptiveStepSize.h"
 #include "config.h"
 
 int main(int argc, char ** argv) {
   DatasetReader datasetReader(DATA_DIR);
-  KillingFusion fusion(datasetReader);
+  VariationalFusion *fusion = VariationalFusion::create(datasetReader);
+
   DisplacementField::testJacobian();
+  DisplacementField::testCompose();
+  DisplacementField::testInvert();
   //DisplacementField::testKillingEnergy();
   SDF::testGetDistance();
   SDF::testGetWeight();
   SDF::testComputeDistanceGradient();
   SDF::testComputeDistanceHessian();
-  // fusion.processTest(1);
-  // fusion.processTest(2);
-  // fusion.processTest(3);
-  fusion.process();
+  SDF::testFuseSaturation();
+  SDF::testGetCachedMesh();
+  SDF::testGetDeformedMesh();
+  SDF::testGetSurfaceNetsMesh();
+  TrilinearSampler::testSampleGrids();
+  ControlLattice::testUpsample();
+  VolumeOps::testVolumeOps();
+  AdaptiveStepSize::testComputeUpdate();
+  // fusion->processTest(1);
+  // fusion->processTest(2);
+  // fusion->processTest(3);
+  fusion->process();
+  delete fusion;
+
 }
 
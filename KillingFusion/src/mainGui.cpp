@@ -4,7 +4,8 @@
 #include <string>
 #include <vector>
 
-#include "KillingFusion.h"
+#include "VariationalFusion.h"
+
 #include "DisplacementField.h"
 #include "DatasetReader.h"
 #include "config.h"
@@ -185,7 +186,8 @@ void displayText(int x, int y, int r, int g, int b, int screenWidth, int screenH
 }
 
 DatasetReader *datasetReader;
-KillingFusion *fusion;
+VariationalFusion *fusion;
+
 std::string outputDirPath;
 bool lastFrameSeen = false;
 
@@ -343,7 +345,8 @@ int main(int argc, char **argv)
 
   datasetReader = new DatasetReader(DATA_DIR);
 
-  fusion = new KillingFusion(*datasetReader);
+  fusion = VariationalFusion::create(*datasetReader);
+
 
   // Create output directory to save screenshot
   std::stringstream outputDirStream;